@@ -0,0 +1,463 @@
+// Headless throughput benchmark: frames from the SYNTHETIC or REPLAY
+// backend go through the same captureFrame/lease path as a camera, then
+// through ISPPipeline. Prints per-stage timings, the frame buffers the
+// pipeline allocated, which stop once it reaches steady state, and every
+// heap allocation made while the ISP ran: operator new is replaced and,
+// on glibc, malloc and friends are interposed. Allocations on any thread
+// count, OpenCV's worker pool included. --check-allocations fails the run
+// if any frame in its second half allocated. The in-house stages stop
+// allocating once steady; --denoise nlm, --demosaic vng|ea and --color
+// staged call OpenCV routines that allocate on every frame, and fail it.
+// --depth 16 runs the 16-bit internal path; the bytes per frame and the
+// 8-bit output codes it uses, against --depth 8, show its bandwidth cost
+// and what it buys in tonal resolution. --preview WxH reduces frames to
+// a display of that size before the ISP, as the GUI's preview does.
+//
+//   isp_benchmark [--synthetic | --replay FILE] [--size WxH] [--fps N]
+//                 [--format bgr|raw8|raw10|raw12] [--frames N] [--realtime]
+//                 [--no-denoise] [--denoise temporal|nlm|guided|grid] [--no-sharpen]
+//                 [--sharpen-radius N] [--sharpen-threshold T]
+//                 [--color staged|fused|lut3d] [--cube FILE]
+//                 [--tiled] [--tile-rows N] [--record FILE]
+//                 [--demosaic bilinear|mhc|vng|ea] [--black-level N] [--depth 8|16]
+//                 [--preview WxH] [--check-allocations]
+
+#include "CameraCapture.h"
+#include "FrameSequence.h"
+#include "ISPPipeline.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+
+namespace {
+
+std::atomic<uint64_t> heap_allocations{0};
+
+} // namespace
+
+#if defined(__GLIBC__)
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* ptr);
+
+// The executable's definitions take precedence over libc's for every
+// library, OpenCV and libstdc++'s operator new among them
+void* malloc(size_t size) {
+    heap_allocations++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    heap_allocations++;
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    heap_allocations++;
+    return __libc_realloc(ptr, size);
+}
+
+void* memalign(size_t alignment, size_t size) {
+    heap_allocations++;
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    heap_allocations++;
+    return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size) {
+    heap_allocations++;
+    void* block = __libc_memalign(alignment, size);
+    if (!block) {
+        return ENOMEM;
+    }
+    *ptr = block;
+    return 0;
+}
+
+void free(void* ptr) {
+    __libc_free(ptr);
+}
+} // extern "C"
+
+namespace {
+void* rawAllocate(size_t size) { return __libc_malloc(size); }
+void rawFree(void* ptr) { __libc_free(ptr); }
+} // namespace
+#else
+namespace {
+void* rawAllocate(size_t size) { return std::malloc(size); }
+void rawFree(void* ptr) { std::free(ptr); }
+} // namespace
+#endif
+
+// Counted here and allocated past the interposed malloc, so each counts once
+void* operator new(size_t size) {
+    heap_allocations++;
+    void* block = rawAllocate(size ? size : 1);
+    if (!block) {
+        throw std::bad_alloc();
+    }
+    return block;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    heap_allocations++;
+    return rawAllocate(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return operator new(size, std::nothrow);
+}
+
+void operator delete(void* ptr) noexcept { rawFree(ptr); }
+void operator delete[](void* ptr) noexcept { rawFree(ptr); }
+void operator delete(void* ptr, size_t) noexcept { rawFree(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { rawFree(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { rawFree(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { rawFree(ptr); }
+
+namespace {
+
+struct Timings {
+    std::vector<double> samples_ms;
+    
+    void add(int64_t ticks) {
+        samples_ms.push_back(ticks * 1000.0 / cv::getTickFrequency());
+    }
+    
+    void print(const char* name) const {
+        if (samples_ms.empty()) {
+            return;
+        }
+        std::vector<double> sorted = samples_ms;
+        std::sort(sorted.begin(), sorted.end());
+        double sum = 0.0;
+        for (double v : sorted) sum += v;
+        printf("%-10s mean %8.3f ms  p50 %8.3f  p95 %8.3f  max %8.3f\n", name,
+               sum / sorted.size(), sorted[sorted.size() / 2],
+               sorted[std::min(sorted.size() - 1, sorted.size() * 95 / 100)],
+               sorted.back());
+    }
+};
+
+void usage() {
+    fprintf(stderr, 
+            "usage: isp_benchmark [--synthetic | --replay FILE] [--size WxH] [--fps N]\n"
+            "                     [--format bgr|raw8|raw10|raw12] [--frames N] [--realtime]\n"
+            "                     [--no-denoise] [--denoise temporal|nlm|guided|grid] [--no-sharpen]\n"
+            "                     [--sharpen-radius N] [--sharpen-threshold T]\n"
+            "                     [--color staged|fused|lut3d] [--cube FILE]\n"
+            "                     [--tiled] [--tile-rows N] [--record FILE]\n"
+            "                     [--demosaic bilinear|mhc|vng|ea] [--black-level N] [--depth 8|16]\n"
+            "                     [--preview WxH] [--check-allocations]\n");
+}
+
+// Distinct 8-bit codes per channel in a frame as it would be displayed,
+// averaged over the channels; banding shows as missing codes
+double displayCodes(const cv::Mat& bgr) {
+    cv::Mat display = bgr;
+    if (bgr.depth() == CV_16U) {
+        bgr.convertTo(display, CV_8U, 1.0 / 257.0);
+    }
+    bool used[3][256] = {};
+    for (int y = 0; y < display.rows; ++y) {
+        const uchar* row = display.ptr<uchar>(y);
+        for (int x = 0; x < display.cols * 3; ++x) {
+            used[x % 3][row[x]] = true;
+        }
+    }
+    int codes = 0;
+    for (int c = 0; c < 3; ++c) {
+        codes += static_cast<int>(std::count(used[c], used[c] + 256, true));
+    }
+    return codes / 3.0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    CameraCapture::CaptureBackend backend = CameraCapture::SYNTHETIC;
+    CameraCapture::CaptureOptions options;
+    CameraCapture::PixelFormat format = CameraCapture::FORMAT_BGR24;
+    options.realtime = false;
+    int width = 1920;
+    int height = 1080;
+    int fps = 30;
+    int frames = 300;
+    bool denoise = true;
+    auto denoise_mode = ISPPipeline::ISPParameters::DenoiseMode::TEMPORAL;
+    bool sharpen = true;
+    int sharpen_radius = 2;
+    float sharpen_threshold = 0.0f;
+    auto color_path = ISPPipeline::ISPParameters::ColorPath::FUSED;
+    std::string cube_path;
+    bool tiled = false;
+    int tile_rows = 64;
+    std::string record_path;
+    auto demosaic = ISPPipeline::ISPParameters::DemosaicMethod::MALVAR_HE_CUTLER;
+    int black_level = 0;
+    bool high_bit_depth = false;
+    cv::Size preview;
+    bool check_allocations = false;
+    
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--synthetic") {
+            backend = CameraCapture::SYNTHETIC;
+        } else if (arg == "--replay" && has_value) {
+            backend = CameraCapture::REPLAY;
+            options.replay_path = argv[++i];
+        } else if (arg == "--size" && has_value) {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2) {
+                usage();
+                return 1;
+            }
+        } else if (arg == "--fps" && has_value) {
+            fps = atoi(argv[++i]);
+        } else if (arg == "--frames" && has_value) {
+            frames = atoi(argv[++i]);
+        } else if (arg == "--format" && has_value) {
+            std::string name = argv[++i];
+            if (name == "raw8") format = CameraCapture::FORMAT_RAW8;
+            else if (name == "raw10") format = CameraCapture::FORMAT_RAW10;
+            else if (name == "raw12") format = CameraCapture::FORMAT_RAW12;
+            else format = CameraCapture::FORMAT_BGR24;
+        } else if (arg == "--realtime") {
+            options.realtime = true;
+        } else if (arg == "--no-denoise") {
+            denoise = false;
+        } else if (arg == "--denoise" && has_value) {
+            std::string name = argv[++i];
+            if (name == "nlm") denoise_mode = ISPPipeline::ISPParameters::DenoiseMode::NLM;
+            else if (name == "guided") denoise_mode = ISPPipeline::ISPParameters::DenoiseMode::GUIDED;
+            else if (name == "grid") denoise_mode = ISPPipeline::ISPParameters::DenoiseMode::BILATERAL_GRID;
+            else denoise_mode = ISPPipeline::ISPParameters::DenoiseMode::TEMPORAL;
+        } else if (arg == "--no-sharpen") {
+            sharpen = false;
+        } else if (arg == "--sharpen-radius" && has_value) {
+            sharpen_radius = atoi(argv[++i]);
+        } else if (arg == "--sharpen-threshold" && has_value) {
+            sharpen_threshold = static_cast<float>(atof(argv[++i]));
+        } else if (arg == "--color" && has_value) {
+            std::string name = argv[++i];
+            if (name == "staged") color_path = ISPPipeline::ISPParameters::ColorPath::STAGED;
+            else if (name == "lut3d") color_path = ISPPipeline::ISPParameters::ColorPath::LUT_3D;
+            else color_path = ISPPipeline::ISPParameters::ColorPath::FUSED;
+        } else if (arg == "--cube" && has_value) {
+            cube_path = argv[++i];
+            color_path = ISPPipeline::ISPParameters::ColorPath::LUT_3D;
+        } else if (arg == "--tiled") {
+            tiled = true;
+        } else if (arg == "--tile-rows" && has_value) {
+            tile_rows = atoi(argv[++i]);
+            tiled = true;
+        } else if (arg == "--record" && has_value) {
+            record_path = argv[++i];
+        } else if (arg == "--demosaic" && has_value) {
+            std::string name = argv[++i];
+            if (name == "bilinear") demosaic = ISPPipeline::ISPParameters::DemosaicMethod::BILINEAR;
+            else if (name == "vng") demosaic = ISPPipeline::ISPParameters::DemosaicMethod::VNG;
+            else if (name == "ea") demosaic = ISPPipeline::ISPParameters::DemosaicMethod::EDGE_AWARE;
+            else demosaic = ISPPipeline::ISPParameters::DemosaicMethod::MALVAR_HE_CUTLER;
+        } else if (arg == "--black-level" && has_value) {
+            black_level = atoi(argv[++i]);
+        } else if (arg == "--preview" && has_value) {
+            if (sscanf(argv[++i], "%dx%d", &preview.width, &preview.height) != 2) {
+                usage();
+                return 1;
+            }
+        } else if (arg == "--check-allocations") {
+            check_allocations = true;
+        } else if (arg == "--depth" && has_value) {
+            high_bit_depth = atoi(argv[++i]) > 8;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    
+    CameraCapture camera;
+    camera.setCaptureOptions(options);
+    camera.setPreferredFormat(format);
+    if (!camera.initialize(0, width, height, fps, backend)) {
+        fprintf(stderr, "failed to open the %s source\n",
+                backend == CameraCapture::REPLAY ? "replay" : "synthetic");
+        return 1;
+    }
+    
+    FrameSequenceWriter writer;
+    if (!record_path.empty() &&
+        !writer.open(record_path, camera.getWidth(), camera.getHeight(),
+                     camera.getPixelFormat(), camera.getBayerPattern(), camera.getFPS())) {
+        fprintf(stderr, "cannot write %s\n", record_path.c_str());
+        return 1;
+    }
+    
+    ISPPipeline isp;
+    ISPPipeline::ISPParameters params = isp.getParameters();
+    params.denoise_enabled = denoise;
+    params.denoise_mode = denoise_mode;
+    params.sharpen_enabled = sharpen;
+    params.sharpen_radius = sharpen_radius;
+    params.sharpen_threshold = sharpen_threshold;
+    params.color_path = color_path;
+    params.tiled_execution = tiled;
+    params.tile_height = tile_rows;
+    params.demosaic_method = demosaic;
+    params.black_level = black_level;
+    params.high_bit_depth = high_bit_depth;
+    isp.setParameters(params);
+    if (!cube_path.empty() && !isp.loadColorLUT(cube_path)) {
+        fprintf(stderr, "cannot read %s\n", cube_path.c_str());
+        return 1;
+    }
+    
+    printf("%dx%d, %s, %d frames\n", camera.getWidth(), camera.getHeight(),
+           CameraCapture::isRawFormat(camera.getPixelFormat()) ? "raw Bayer" : "BGR", frames);
+    
+    Timings capture_times;
+    Timings isp_times;
+    Timings tile_times;
+    double tile_stage_ms[4] = {};
+    CameraCapture::FrameLease lease;
+    cv::Mat bgr;
+    cv::Mat bayer;
+    cv::Mat reduced;
+    cv::Mat output;
+    int64_t start = cv::getTickCount();
+    int processed = 0;
+    int last_allocating_frame = -1;
+    uint64_t heap_total = 0;
+    uint64_t heap_last_frame = 0;
+    int last_heap_frame = -1;
+    
+    for (int i = 0; i < frames; ++i) {
+        int64_t t0 = cv::getTickCount();
+        if (!camera.acquireFrame(lease)) {
+            break;
+        }
+        int64_t t1 = cv::getTickCount();
+        
+        if (writer.isOpen()) {
+            writer.write(lease.image(), lease.metadata());
+        }
+        
+        // The preview reduction counts as ISP time, not as ISP heap traffic
+        const bool raw = CameraCapture::isRawFormat(lease.pixelFormat());
+        const cv::Mat* input = nullptr;
+        if (raw) {
+            camera.unpackRawFrame(lease, bayer);
+            input = &bayer;
+            if (!preview.empty()) {
+                const int factor = std::min(bayer.cols / preview.width, bayer.rows / preview.height);
+                if (factor >= 2) {
+                    BayerDemosaic::bin(bayer, reduced, factor);
+                    input = &reduced;
+                }
+            }
+        } else {
+            camera.convertFrame(lease, bgr);
+            input = &bgr;
+            const double scale = preview.empty() ? 1.0 : 
+                std::min(static_cast<double>(preview.width) / bgr.cols,
+                         static_cast<double>(preview.height) / bgr.rows);
+            if (scale < 1.0) {
+                cv::resize(bgr, reduced, cv::Size(), scale, scale, cv::INTER_AREA);
+                input = &reduced;
+            }
+        }
+        
+        const uint64_t heap_before = heap_allocations.load();
+        if (raw) {
+            isp.processRaw(*input, output,
+                           static_cast<ISPPipeline::BayerPattern>(lease.bayerPattern()),
+                           CameraCapture::rawBitDepth(lease.pixelFormat()));
+        } else {
+            isp.processRGB(*input, output);
+        }
+        heap_last_frame = heap_allocations.load() - heap_before;
+        int64_t t2 = cv::getTickCount();
+        
+        heap_total += heap_last_frame;
+        if (heap_last_frame > 0) {
+            last_heap_frame = processed;
+        }
+        
+        capture_times.add(t1 - t0);
+        isp_times.add(t2 - t1);
+        if (isp.getFrameBufferAllocations() > 0) {
+            last_allocating_frame = processed;
+        }
+        for (const auto& tile : isp.getTileTimings()) {
+            tile_times.samples_ms.push_back(tile.total_ms);
+            tile_stage_ms[0] += tile.lens_ms;
+            tile_stage_ms[1] += tile.color_ms;
+            tile_stage_ms[2] += tile.denoise_ms;
+            tile_stage_ms[3] += tile.sharpen_ms;
+        }
+        processed++;
+        lease.release();
+    }
+    
+    double seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+    capture_times.print("capture");
+    isp_times.print("isp");
+    if (!tile_times.samples_ms.empty()) {
+        tile_times.print("tile");
+        double total = tile_stage_ms[0] + tile_stage_ms[1] + tile_stage_ms[2] + tile_stage_ms[3];
+        if (total > 0.0) {
+            printf("tile time: lens %.0f%%, color %.0f%%, denoise %.0f%%, sharpen %.0f%%\n",
+                   100.0 * tile_stage_ms[0] / total, 100.0 * tile_stage_ms[1] / total,
+                   100.0 * tile_stage_ms[2] / total, 100.0 * tile_stage_ms[3] / total);
+        }
+    }
+    printf("%d frames in %.2f s: %.1f fps\n", processed, seconds, 
+           seconds > 0.0 ? processed / seconds : 0.0);
+    printf("buffer allocations: %llu, none after frame %d\n",
+           static_cast<unsigned long long>(isp.getBufferAllocations()), last_allocating_frame);
+    printf("heap allocations in the ISP: %llu, %llu in the last frame, none after frame %d\n",
+           static_cast<unsigned long long>(heap_total),
+           static_cast<unsigned long long>(heap_last_frame), last_heap_frame);
+    if (!output.empty()) {
+        printf("%d-bit output: %.1f MB per frame, %.1f of 256 display codes per channel\n",
+               output.depth() == CV_16U ? 16 : 8, 
+               output.total() * output.elemSize() / (1024.0 * 1024.0), displayCodes(output));
+    }
+    
+    auto stats = camera.getStats();
+    if (stats.dropped_by_driver > 0) {
+        printf("source dropped %llu frames\n", 
+               static_cast<unsigned long long>(stats.dropped_by_driver));
+    }
+    
+    writer.close();
+    camera.shutdown();
+    
+    const int steady_from = processed / 2;
+    if (check_allocations && 
+        (last_heap_frame >= steady_from || last_allocating_frame >= steady_from)) {
+        printf("FAIL: frames after %d still allocate\n", steady_from);
+        return 1;
+    }
+    return processed > 0 ? 0 : 1;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <opencv2/core.hpp>
+
+// Auto white balance statistics and gain smoothing for 8- or 16-bit BGR
+// frames; statistics are taken in 8-bit levels either way.
+//
+// Statistics come from a subsampled grid of pixels every `interval` frames,
+// skipping pixels with a clipped channel (their colour is not the scene's).
+// The gains estimated from them are approached gradually, and only changes
+// larger than `deadband` are published, so the balance neither flickers
+// with the content nor churns downstream tables. gains() may be called
+// from any thread.
+class AutoWhiteBalance {
+public:
+    enum Method {
+        GRAY_WORLD = 0,     // the average colour is neutral
+        WHITE_PATCH         // the brightest unclipped pixels are neutral
+    };
+
+    struct Settings {
+        Method method = GRAY_WORLD;
+        int interval = 4;           // frames between statistics
+        int step = 8;               // grid spacing in pixels
+        int saturation = 250;       // pixels with a channel at or above are skipped
+        float smoothing = 0.25f;    // fraction of the way to the estimate per update
+        float deadband = 0.002f;    // smallest relative change that is published
+    };
+
+    struct Gains {
+        float blue = 1.0f;
+        float green = 1.0f;
+        float red = 1.0f;
+    };
+
+    void setSettings(const Settings& settings);
+
+    // Feeds the frame about to be balanced; returns true when the
+    // published gains changed. applied are gains the frame already carries
+    // (from a demosaic that balances as it goes); estimates stay absolute.
+    bool update(const cv::Mat& bgr, const Gains& applied = Gains());
+
+    Gains gains() const;
+    void reset(const Gains& gains = Gains());
+
+private:
+    bool estimate(const cv::Mat& bgr, const Gains& applied, Gains& target) const;
+
+    mutable std::mutex mutex_;
+    Settings settings_;
+    Gains gains_;
+    Gains smoothed_;
+    uint64_t frame_count_ = 0;
+    bool converged_once_ = false;
+};
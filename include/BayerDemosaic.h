@@ -0,0 +1,56 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+// Demosaics an 8- or 16-bit Bayer mosaic to BGR, subtracting the black
+// level and applying the white balance gains as each raw row is read, so
+// the mosaic is touched once.
+//
+// Raw values are normalized to a fixed working range after black level
+// and gains, and clipped at white there, as a sensor saturates; the
+// interpolation runs on those values in integer arithmetic. Borders are
+// mirrored by whole CFA cells, so edge pixels keep their colour phase.
+// One instance must not be used by two threads at once.
+class BayerDemosaic {
+public:
+    // Colour of the top-left 2x2 cell of the mosaic
+    enum class Pattern {
+        BGGR = 0,
+        GBRG,
+        GRBG,
+        RGGB
+    };
+
+    enum Method {
+        BILINEAR = 0,       // averages of the nearest samples of each colour
+        MALVAR_HE_CUTLER    // bilinear corrected by the local gradient (ICASSP 2004)
+    };
+
+    struct Settings {
+        Pattern pattern = Pattern::RGGB;
+        Method method = MALVAR_HE_CUTLER;
+        int bit_depth = 8;          // significant bits of 16-bit input
+        int black_level = 0;        // in input units
+        float gain_blue = 1.0f;
+        float gain_green = 1.0f;
+        float gain_red = 1.0f;
+        int output_depth = CV_8U;   // CV_8U or CV_16U (full 16-bit range)
+    };
+
+    // The row buffers are allocated through allocator when one is given
+    void setAllocator(cv::MatAllocator* allocator) { rings_.allocator = allocator; }
+
+    // bayer is CV_8UC1 or CV_16UC1, at least 4x4; bgr gets CV_8UC3 or
+    // CV_16UC3 and must not alias it
+    void process(const cv::Mat& bayer, cv::Mat& bgr, const Settings& settings);
+
+    // Averages factor x factor samples of each colour into one, giving a
+    // mosaic 1/factor the size with the same pattern and depth; the
+    // cheap way to a preview-sized frame. binned must not alias bayer.
+    static void bin(const cv::Mat& bayer, cv::Mat& binned, int factor);
+
+private:
+    // Normalized rows around the output row, five per stripe of the frame;
+    // kept between frames
+    cv::Mat rings_;
+};
@@ -5,6 +5,7 @@
 #include <vector>
 #include <string>
 #include <atomic>
+#include "UndistortMapCache.h"
 
 class CalibrationEngine {
 public:
@@ -47,7 +48,8 @@ public:
     bool saveCalibration(const std::string& filename);
     bool loadCalibration(const std::string& filename);
     
-    void undistortImage(const cv::Mat& input, cv::Mat& output);
+    // alpha as in UndistortMapCache::undistort; < 0 keeps the camera matrix
+    void undistortImage(const cv::Mat& input, cv::Mat& output, double alpha = -1.0);
     
     const CalibrationResult& getResult() const { return result_; }
     size_t getNumCalibrationImages() const { return image_points_.size(); }
@@ -72,6 +74,7 @@ private:
     std::vector<std::vector<cv::Point2f>> image_points_;
     std::vector<std::vector<cv::Point3f>> object_points_;
     cv::Size image_size_;
+    UndistortMapCache undistort_maps_;
     
     std::atomic<bool> calibrated_{false};
     std::atomic<bool> calibration_in_progress_{false};
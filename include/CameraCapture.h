@@ -1,7 +1,12 @@
 #pragma once
 
 #include <atomic>
+#include <cstdint>
+#include <deque>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 #include <functional>
 #include <opencv2/core.hpp>
@@ -19,19 +24,154 @@
 #include <unistd.h>
 #endif
 
+#include "LockFreeQueue.h"
+
+class FrameConverter;
+class FrameSequenceReader;
+
 class CameraCapture {
 public:
     enum CaptureBackend {
         AUTO = 0,
         V4L2,
         DSHOW,
-        OPENCV
+        OPENCV,
+        REPLAY,         // recorded FrameSequence or video file (CaptureOptions::replay_path)
+        SYNTHETIC       // generated moving chessboard, BGR or Bayer
+    };
+
+    enum PixelFormat {
+        FORMAT_AUTO = 0,
+        FORMAT_BGR24,
+        FORMAT_RGB24,
+        FORMAT_YUYV,
+        FORMAT_NV12,
+        FORMAT_MJPEG,
+        FORMAT_RAW8,        // Bayer, one byte per sample
+        FORMAT_RAW10,       // Bayer, 10 bits in little-endian 16-bit words
+        FORMAT_RAW12,       // Bayer, 12 bits in little-endian 16-bit words
+        FORMAT_RAW10P,      // Bayer, MIPI CSI-2 packed: 4 samples in 5 bytes
+        FORMAT_RAW12P       // Bayer, MIPI CSI-2 packed: 2 samples in 3 bytes
+    };
+
+    // Colour of the top-left 2x2 cell, in V4L2 naming (SBGGR, SGBRG, ...)
+    enum BayerPattern {
+        BAYER_BGGR = 0,
+        BAYER_GBRG,
+        BAYER_GRBG,
+        BAYER_RGGB
     };
 
+    // How frames reach a consumer queue (see FrameQueue)
+    enum DeliveryPolicy {
+        DELIVER_LATEST = 0,     // newest frame only, stale frames dropped
+        DELIVER_ALL             // every frame, in order
+    };
+
+    // Applied on the next initialize(). buffer_count is a request; the
+    // driver may grant a different number (see getBufferCount()).
+    struct CaptureOptions {
+        int buffer_count = 4;
+        DeliveryPolicy delivery = DELIVER_LATEST;
+        int queue_capacity = 32;
+        int control_latency_frames = 0;     // sensor pipeline delay for controls
+        
+        // REPLAY and SYNTHETIC. Without realtime, frames come as fast as
+        // they are asked for. Synthetic frames are stamped with the time
+        // they were made; replayed ones keep their recorded timestamps,
+        // moved to the start of the replay, and sequence numbers.
+        std::string replay_path;
+        bool realtime = true;
+        bool loop = true;
+        BayerPattern synthetic_pattern = BAYER_RGGB;
+    };
+
+    // Capabilities as reported by the driver. Stepwise and continuous
+    // ranges are sampled at common sizes and frame rates.
+    struct FrameSizeInfo {
+        int width = 0;
+        int height = 0;
+        std::vector<double> frame_rates;    // fastest first
+    };
+    
+    struct FormatInfo {
+        uint32_t fourcc = 0;
+        PixelFormat format = FORMAT_AUTO;   // AUTO if we cannot decode it
+        BayerPattern bayer_pattern = BAYER_BGGR;
+        std::string description;
+        bool compressed = false;
+        std::vector<FrameSizeInfo> sizes;
+    };
+    
     struct CameraInfo {
         int id;
         std::string name;
-        std::vector<std::pair<int, int>> resolutions;
+        std::vector<std::pair<int, int>> resolutions;   // all formats, ascending
+        std::string device_path;
+        std::string driver;
+        std::string bus_info;
+        uint32_t driver_version = 0;
+        std::vector<FormatInfo> formats;
+        
+        // Frame rates offered at a size by any format we can decode
+        std::vector<double> frameRates(int width, int height) const;
+        
+        // Rebuilds resolutions from formats
+        void updateResolutions();
+    };
+
+    // Per-frame information from the driver. timestamp_ns is on the
+    // monotonic clock (std::chrono::steady_clock on Linux), so it can be
+    // compared directly against steady_clock::now() for latency.
+    struct FrameMetadata {
+        int64_t timestamp_ns = 0;
+        uint64_t sequence = 0;
+        CaptureBackend backend = AUTO;
+        int buffer_index = -1;
+        PixelFormat pixel_format = FORMAT_BGR24;
+        BayerPattern bayer_pattern = BAYER_BGGR;
+        uint64_t control_ticket = 0;    // newest control change in effect
+        uint64_t rejected_ticket = 0;   // newest control change refused
+    };
+
+    // Where frames were lost: skipped driver sequence numbers, frames our
+    // queues discarded, and frames the GUI never got to paint.
+    struct CaptureStats {
+        uint64_t frames_captured = 0;
+        uint64_t dropped_by_driver = 0;
+        uint64_t dropped_by_queue = 0;
+        uint64_t dropped_by_display = 0;
+    };
+
+    // A frame handed out without copying. For V4L2 the image is a header over
+    // the dequeued mmap buffer; the buffer goes back to the driver with
+    // VIDIOC_QBUF once the last copy of the lease is released or destroyed.
+    class FrameLease {
+    public:
+        FrameLease() = default;
+        
+        bool valid() const { return !image_.empty(); }
+        const cv::Mat& image() const { return image_; }
+        const FrameMetadata& metadata() const { return metadata_; }
+        int bufferIndex() const { return metadata_.buffer_index; }
+        PixelFormat pixelFormat() const { return metadata_.pixel_format; }
+        BayerPattern bayerPattern() const { return metadata_.bayer_pattern; }
+        
+        void release();
+        
+        // True while the image points into a driver buffer
+        bool pinsDriverBuffer() const { return requeue_ != nullptr; }
+        
+        // Copies the image and hands the driver buffer back, for consumers
+        // that hold on to frames longer than the driver can spare them.
+        void detach();
+        
+    private:
+        friend class CameraCapture;
+        
+        cv::Mat image_;
+        FrameMetadata metadata_;
+        std::shared_ptr<void> requeue_;
     };
 
     CameraCapture();
@@ -45,25 +185,120 @@ public:
     
     void shutdown();
     
-    bool captureFrame(cv::Mat& frame);
+    bool captureFrame(cv::Mat& frame, FrameMetadata* metadata = nullptr);
+    bool acquireFrame(FrameLease& lease);
+    
+    // Push-mode delivery. startStreaming() runs a capture thread that waits
+    // on the device (epoll on V4L2) and hands every frame to the registered
+    // consumers on that thread. Consumers should return quickly; copying
+    // the lease to keep the frame is cheap. Do not mix with acquireFrame().
+    using FrameCallback = std::function<void(const FrameLease& lease)>;
+    int addFrameConsumer(FrameCallback callback);
+    void removeFrameConsumer(int id);
+    bool startStreaming();
+    void stopStreaming();
+    bool isStreaming() const { return streaming_; }
+    
+    // For an external reactor driving several cameras (CaptureGroup).
+    // pollFd() is readable when pollFrame() has a frame; -1 means the
+    // backend has no fd and has to be polled. pollFrame() never waits on
+    // V4L2. While it returns false with restartPending() set, release any
+    // leases held on this camera and keep calling it; the stream reopens
+    // on the first call after the last lease is back, pollFd() is -1 until
+    // then and may change.
+    int pollFd() const;
+    bool pollFrame(FrameLease& lease);
+    bool restartPending() const { return restart_pending_; }
+    
+    // Converts a leased frame in its native format into BGR, writing into
+    // bgr's existing allocation when the size matches.
+    bool convertFrame(const FrameLease& lease, cv::Mat& bgr);
     
-    bool setResolution(int width, int height);
-    bool setFPS(int fps);
-    bool setExposure(int exposure);
-    bool setGain(int gain);
-    bool setWhiteBalance(int red, int green, int blue);
+    // Unpacks a raw Bayer lease into a CV_8UC1 or CV_16UC1 mosaic (samples
+    // right-aligned, see rawBitDepth()). RAW8/10/12 return a header over the
+    // driver buffer without copying.
+    bool unpackRawFrame(const FrameLease& lease, cv::Mat& bayer);
     
-    std::vector<CameraInfo> listAvailableCameras();
+    static bool isRawFormat(PixelFormat format);
+    static int rawBitDepth(PixelFormat format);
+    
+    // Format to negotiate on the next initialize(); AUTO picks the best
+    // native format for the requested size and frame rate.
+    void setPreferredFormat(PixelFormat format) { preferred_format_ = format; }
+    PixelFormat getPixelFormat() const { return pixel_format_; }
+    
+    void setCaptureOptions(const CaptureOptions& options) { options_ = options; }
+    const CaptureOptions& getCaptureOptions() const { return options_; }
+    int getBufferCount() const { return buffer_count_; }
+    BayerPattern getBayerPattern() const { return bayer_pattern_; }
+    
+    // Controls are queued without blocking and applied by whichever thread
+    // dequeues frames (the capture thread while streaming, otherwise the
+    // next acquireFrame()), in between dequeues. ticket identifies the
+    // change: the first frame whose FrameMetadata::control_ticket is at
+    // least ticket was exposed with it, unless the ticket was rejected.
+    // A change the driver refuses (or a restart that falls back to the old
+    // geometry) never takes effect, even once control_ticket passes it;
+    // nor do the older requests of its kind it superseded.
+    // FrameMetadata::rejected_ticket flags that one was refused and
+    // controlRejected() tells which. Values are in driver units
+    // (V4L2_CID_EXPOSURE_ABSOLUTE is 100 us). A resolution change, or a
+    // frame rate change the driver refuses while streaming, restarts the
+    // stream. Before initialize() only the size and rate are accepted.
+    bool setResolution(int width, int height, uint64_t* ticket = nullptr);
+    bool setFPS(int fps, uint64_t* ticket = nullptr);
+    bool setExposure(int exposure, uint64_t* ticket = nullptr);
+    bool setGain(int gain, uint64_t* ticket = nullptr);
+    bool setWhiteBalance(int red, int green, int blue, uint64_t* ticket = nullptr);
+    
+    // Whether the change with this ticket was refused; the last
+    // kMaxRejectedTickets refusals are remembered. Any thread.
+    bool controlRejected(uint64_t ticket) const;
+    
+    // Queries devices with ioctls only; nothing is streamed or reconfigured,
+    // so this is safe while another device (or this one) is capturing.
+    // Without query_formats only the identity (name, driver, bus) is read.
+    static std::vector<CameraInfo> listAvailableCameras(bool query_formats = true);
+    static bool probeCamera(int camera_id, CameraInfo& info, bool query_formats = true);
     
     bool isInitialized() const { return initialized_; }
+    CaptureBackend getBackend() const { return backend_; }
     int getWidth() const { return width_; }
     int getHeight() const { return height_; }
     int getFPS() const { return fps_; }
+    
+    CaptureStats getStats() const;
+    void resetStats();
+    void recordQueueDrop(uint64_t count = 1) { dropped_by_queue_ += count; }
+    void recordDisplayDrop(uint64_t count = 1) { dropped_by_display_ += count; }
 
 private:
+    struct ControlRequest {
+        enum Type {
+            EXPOSURE = 0,
+            GAIN,
+            WHITE_BALANCE,
+            FRAME_RATE,
+            RESOLUTION,
+            TYPE_COUNT
+        };
+        Type type = EXPOSURE;
+        int values[3] = {0, 0, 0};
+        uint64_t ticket = 0;
+    };
+    
+    // Applied control waiting for the first frame exposed after it
+    struct PendingControl {
+        int64_t applied_ns = 0;
+        uint64_t ticket = 0;
+        int64_t effect_sequence = -1;
+    };
+    
 #ifdef _WIN32
+    friend class SampleGrabberCallback;
     bool initDirectShow();
     void cleanupDirectShow();
+    void pushDirectShowFrame(const cv::Mat& frame);
     IGraphBuilder* graph_builder_ = nullptr;
     IMediaControl* media_control_ = nullptr;
     IMediaEvent* media_event_ = nullptr;
@@ -72,27 +307,128 @@ private:
     AM_MEDIA_TYPE media_type_;
     HANDLE frame_event_ = nullptr;
 #else
+    struct V4L2Buffer {
+        void* start = nullptr;
+        size_t length = 0;
+    };
+    
+    // Device fd and the per-index mmap table. Shared with outstanding leases
+    // so the mappings stay valid until the last one is released.
+    struct V4L2Stream {
+        int fd = -1;
+        std::vector<V4L2Buffer> buffers;
+        size_t bytes_per_line = 0;
+        PixelFormat format = FORMAT_RGB24;
+        BayerPattern pattern = BAYER_BGGR;
+        std::atomic<bool> streaming{false};
+        
+        bool requeue(int index);
+        ~V4L2Stream();
+    };
+    
     bool initV4L2();
     void cleanupV4L2();
-    int v4l2_fd_ = -1;
-    void* v4l2_buffer_ = nullptr;
-    size_t v4l2_buffer_size_ = 0;
+    bool negotiateFormatV4L2(int fd, v4l2_format& format);
+    bool acquireV4L2(FrameLease& lease);
+    bool dequeueV4L2(const std::shared_ptr<V4L2Stream>& stream, FrameLease& lease);
+    void captureLoopV4L2();
+    int stop_event_fd_ = -1;
+    static PixelFormat fromFourcc(uint32_t fourcc, BayerPattern* pattern = nullptr);
+    static bool probeCameraV4L2(const std::string& device_path, CameraInfo& info,
+                                bool query_formats);
+    bool applyControlV4L2(int fd, const ControlRequest& request, bool& restart);
+    
+    // A size or rate change closes the stream, and the device is reopened
+    // only once every lease on the old one is back: V4L2 refuses to
+    // reallocate buffers that are still mapped. restartV4L2() does nothing
+    // until then; it returns false when the device could not be reopened.
+    void beginRestartV4L2(const ControlRequest& restart);
+    bool restartV4L2();
+    std::shared_ptr<V4L2Stream> v4l2_stream_;
+    std::weak_ptr<V4L2Stream> retired_stream_;
 #endif
 
+    bool queueControl(ControlRequest::Type type, int a, int b, int c, uint64_t* ticket);
+    bool applyControls(ControlRequest& restart);
+    void rejectControls(const std::vector<uint64_t>& tickets);
+    bool applyControlOpenCV(const ControlRequest& request);
+    
     bool initOpenCV();
     void cleanupOpenCV();
+    bool initReplay();
+    void cleanupReplay();
+    bool readReplay(FrameLease& lease, bool block);
+    bool initSynthetic();
+    bool renderSynthetic(FrameLease& lease, bool block);
+    bool waitForFrameTime(int64_t due_ns, bool block);
+    cv::Mat& nextPoolBuffer(int rows, int cols, int type);
+    void stampFrame(FrameMetadata& metadata, int64_t timestamp_ns, 
+                    int64_t sequence, bool start_of_exposure = false);
+    void deliverFrame(const FrameLease& lease);
     
     cv::VideoCapture* opencv_cap_ = nullptr;
     
+    // REPLAY / SYNTHETIC: frames are handed out from a small pool, like
+    // driver buffers, so leases stay valid while the next frame is made
+    std::unique_ptr<FrameSequenceReader> replay_reader_;
+    std::unique_ptr<cv::VideoCapture> replay_video_;
+    std::vector<cv::Mat> frame_pool_;
+    size_t next_pool_buffer_ = 0;
+    int64_t pacing_start_ns_ = 0;       // monotonic time of the first frame
+    int64_t replay_first_ts_ = -1;      // recorded timestamp of the first frame
+    uint64_t generated_frames_ = 0;
+    cv::Mat replay_frame_;
+    FrameMetadata replay_metadata_;
+    bool replay_frame_ready_ = false;
+    
     CaptureBackend backend_ = AUTO;
-    bool initialized_ = false;
+    PixelFormat preferred_format_ = FORMAT_AUTO;
+    PixelFormat pixel_format_ = FORMAT_BGR24;
+    BayerPattern bayer_pattern_ = BAYER_BGGR;
+    CaptureOptions options_;
+    int buffer_count_ = 1;
+    std::unique_ptr<FrameConverter> converter_;
+    std::atomic<bool> initialized_{false};
     std::atomic<bool> running_{false};
     
     int camera_id_ = 0;
-    int width_ = 640;
-    int height_ = 480;
-    int fps_ = 30;
+    
+    // Written by the dequeuing thread when the stream restarts, read by
+    // any thread
+    std::atomic<int> width_{640};
+    std::atomic<int> height_{480};
+    std::atomic<int> fps_{30};
     
     cv::Mat current_frame_;
     std::mutex frame_mutex_;
+    
+    using ConsumerList = std::vector<std::pair<int, FrameCallback>>;
+    std::shared_ptr<const ConsumerList> consumers_;
+    std::mutex consumers_mutex_;
+    int next_consumer_id_ = 1;
+    std::thread capture_thread_;
+    std::atomic<bool> streaming_{false};
+    
+    LockFreeQueue<ControlRequest> control_queue_{64};
+    std::atomic<uint64_t> next_control_ticket_{1};
+    std::deque<PendingControl> pending_controls_;
+    ControlRequest pending_restart_;
+    std::atomic<bool> restart_pending_{false};
+    uint64_t control_ticket_ = 0;
+    
+    // Tickets the driver refused, oldest first, and those the pending
+    // restart carries, so a failed restart can refuse them all
+    static constexpr size_t kMaxRejectedTickets = 64;
+    mutable std::mutex rejected_mutex_;
+    std::deque<uint64_t> rejected_tickets_;
+    std::atomic<uint64_t> rejected_ticket_{0};
+    std::vector<uint64_t> restart_tickets_;
+    
+    int64_t last_sequence_ = -1;
+    int64_t sequence_offset_ = 0;   // keeps sequences increasing across restarts
+    uint64_t software_sequence_ = 0;
+    std::atomic<uint64_t> frames_captured_{0};
+    std::atomic<uint64_t> dropped_by_driver_{0};
+    std::atomic<uint64_t> dropped_by_queue_{0};
+    std::atomic<uint64_t> dropped_by_display_{0};
 };
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "CameraCapture.h"
+
+// Captures from several cameras on one epoll reactor thread and matches
+// their frames into framesets by kernel timestamp (CLOCK_MONOTONIC, shared
+// by all V4L2 devices). A frameset is delivered as soon as every camera has
+// a frame within the tolerance; if a camera's frame is missing it is
+// delivered incomplete once the other cameras have moved on, or after the
+// missing timeout. Linux only.
+class CaptureGroup {
+public:
+    // frames[i] belongs to camera i and is invalid when it was missing
+    struct FrameSet {
+        std::vector<CameraCapture::FrameLease> frames;
+        uint64_t sequence = 0;
+        int64_t timestamp_ns = 0;   // earliest frame in the set
+        int64_t skew_ns = 0;        // latest minus earliest present frame
+        bool complete = false;
+    };
+    
+    struct SyncStats {
+        uint64_t framesets = 0;
+        uint64_t incomplete = 0;
+        uint64_t unmatched_frames = 0;  // discarded without being delivered
+        int64_t max_skew_ns = 0;
+    };
+    
+    using FrameSetCallback = std::function<void(const FrameSet& set)>;
+    
+    CaptureGroup();
+    ~CaptureGroup();
+    
+    // Cameras must be initialized and not streaming on their own, on a
+    // backend whose pollFrame() does not block (V4L2, REPLAY, SYNTHETIC)
+    int addCamera(std::shared_ptr<CameraCapture> camera);
+    void clear();
+    size_t size() const { return members_.size(); }
+    std::shared_ptr<CameraCapture> camera(size_t index) const;
+    
+    void setTolerance(int64_t tolerance_ns) { tolerance_ns_ = tolerance_ns; }
+    void setMissingTimeout(int64_t timeout_ns) { missing_timeout_ns_ = timeout_ns; }
+    
+    // Called on the reactor thread; return quickly
+    void setFrameSetCallback(FrameSetCallback callback);
+    
+    bool start();
+    void stop();
+    bool isRunning() const { return running_; }
+    
+    SyncStats getStats() const;
+    void resetStats();
+    
+private:
+    struct Member {
+        std::shared_ptr<CameraCapture> camera;
+        int fd = -1;                // registered with epoll, -1 if polled
+        int64_t resume_ns = 0;      // re-register after an error back-off
+        std::deque<CameraCapture::FrameLease> pending;
+    };
+    
+    void reactorLoop();
+    void serviceCamera(Member& member, int epoll_fd);
+    void matchFrameSets(int64_t now_ns);
+    void emitFrameSet(FrameSet& set);
+    
+    std::vector<Member> members_;
+    FrameSetCallback callback_;
+    int64_t tolerance_ns_ = 5000000;            // 5 ms
+    int64_t missing_timeout_ns_ = 100000000;    // 100 ms
+    const size_t max_pending_ = 2;              // driver buffers held per camera
+    
+    std::thread reactor_thread_;
+    std::atomic<bool> running_{false};
+    int stop_event_fd_ = -1;
+    uint64_t next_sequence_ = 0;
+    
+    mutable std::mutex stats_mutex_;
+    SyncStats stats_;
+};
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+
+// A size^3 colour lattice applied to 8-bit BGR frames with tetrahedral
+// interpolation, so any chain of per-pixel colour operations costs the
+// same four lattice reads per pixel.
+//
+// Lattice entries are BGR in [0, 1], indexed blue-major, then green, with
+// red varying fastest (the .cube data order).
+class ColorLUT3D {
+public:
+    // Maps a BGR colour in [0, 1] to a BGR colour in [0, 1]
+    using Transform = std::function<cv::Vec3f(const cv::Vec3f&)>;
+
+    ColorLUT3D() = default;
+
+    // transform is called concurrently from worker threads
+    void bake(int size, const Transform& transform);
+
+    // Adobe/Resolve .cube, 3D tables only. Returns false and leaves the
+    // lattice untouched if the file cannot be parsed.
+    bool loadCube(const std::string& filename);
+
+    // Tetrahedral interpolation at full float precision, for composing
+    // lattices while baking
+    cv::Vec3f lookup(const cv::Vec3f& bgr) const;
+
+    // src and dst are CV_8UC3 and may be the same Mat
+    void apply(const cv::Mat& src, cv::Mat& dst) const;
+
+    bool empty() const { return size_ == 0; }
+    int size() const { return size_; }
+    const std::string& title() const { return title_; }
+
+private:
+    void buildFixedPoint();
+
+    int size_ = 0;
+    std::string title_;
+    cv::Vec3f domain_min_ = cv::Vec3f(0.0f, 0.0f, 0.0f);
+    cv::Vec3f domain_max_ = cv::Vec3f(1.0f, 1.0f, 1.0f);
+    std::vector<cv::Vec3f> lattice_;
+
+    // apply() tables: entries as Q7 8-bit values, and per channel, for each
+    // 8-bit input, its lower lattice index and Q8 weight towards the next
+    std::vector<uint16_t> fixed_;
+    int index_[3][256] = {};
+    int weight_[3][256] = {};
+};
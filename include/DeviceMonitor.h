@@ -0,0 +1,54 @@
+#pragma once
+
+#include <QThread>
+#include <QMutex>
+#include <QMetaType>
+#include <map>
+#include <string>
+#include <vector>
+#include "CameraCapture.h"
+
+// Watches for cameras being plugged in and removed, off the GUI thread.
+// On Linux this is inotify on /dev; elsewhere the device list is polled.
+//
+// Full capability probes are kept in a cache keyed by driver, card name,
+// bus and driver version, so a camera seen before (this session or, via
+// loadCache(), a previous one) only costs a VIDIOC_QUERYCAP.
+class DeviceMonitor : public QThread {
+    Q_OBJECT
+    
+public:
+    DeviceMonitor(QObject* parent = nullptr);
+    ~DeviceMonitor();
+    
+    void stop();
+    
+    bool loadCache(const std::string& filename);
+    bool saveCache(const std::string& filename) const;
+    
+    std::vector<CameraCapture::CameraInfo> cameras() const;
+    
+signals:
+    // Emitted for every camera present at start, then on each change
+    void cameraAdded(const CameraCapture::CameraInfo& info);
+    void cameraRemoved(int camera_id);
+    
+protected:
+    void run() override;
+    
+private:
+    void scanDevices();
+    void deviceAppeared(int camera_id);
+    void deviceDisappeared(int camera_id);
+    bool probeCached(int camera_id, CameraCapture::CameraInfo& info);
+    static std::string cacheKey(const CameraCapture::CameraInfo& info);
+    
+    mutable QMutex mutex_;
+    std::map<std::string, CameraCapture::CameraInfo> cache_;
+    std::map<int, CameraCapture::CameraInfo> present_;
+    
+    int stop_event_fd_ = -1;
+    std::atomic<bool> stop_requested_{false};
+};
+
+Q_DECLARE_METATYPE(CameraCapture::CameraInfo)
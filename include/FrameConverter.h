@@ -0,0 +1,39 @@
+#pragma once
+
+#include "CameraCapture.h"
+#include <opencv2/core.hpp>
+
+// Turns native camera frames (YUYV, NV12, MJPEG, RGB24) into the BGR layout
+// the ISP expects. Each conversion is a single pass that writes straight
+// into the destination Mat, reusing its allocation across frames.
+class FrameConverter {
+public:
+    FrameConverter();
+    ~FrameConverter();
+    
+    FrameConverter(const FrameConverter&) = delete;
+    FrameConverter& operator=(const FrameConverter&) = delete;
+    
+    // src is the frame as leased from the driver: CV_8UC2 for YUYV, a
+    // (height * 3/2) x width CV_8UC1 plane for NV12, a 1 x N byte row for
+    // MJPEG and CV_8UC3 for RGB24/BGR24.
+    bool toBGR(const cv::Mat& src, CameraCapture::PixelFormat format, cv::Mat& bgr);
+    
+    // MIPI CSI-2 packed rows (CV_8UC1, width * 5/4 or width * 3/2 bytes)
+    // to a right-aligned CV_16UC1 mosaic.
+    bool unpackRaw10(const cv::Mat& packed, cv::Mat& bayer16);
+    bool unpackRaw12(const cv::Mat& packed, cv::Mat& bayer16);
+    
+    // Bilinear demosaic to 8-bit BGR for consumers that bypass the raw ISP
+    bool demosaicPreview(const cv::Mat& bayer, CameraCapture::BayerPattern pattern,
+                         int bit_depth, cv::Mat& bgr);
+    
+private:
+    bool decodeMJPEG(const cv::Mat& jpeg, cv::Mat& bgr);
+    
+    cv::Mat bayer8_;
+    
+#ifdef HAVE_TURBOJPEG
+    void* tj_handle_ = nullptr;
+#endif
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "CameraCapture.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+// Hand-off between a camera's capture thread and a consumer thread.
+//
+// LATEST_ONLY keeps a single slot and replaces whatever is waiting, so the
+// consumer always sees the newest frame (low-latency preview).
+// IN_ORDER delivers every frame in sequence (recording, calibration). Only
+// lease_budget entries may pin driver buffers; frames beyond that are copied
+// out so the driver never runs dry. A full queue blocks the producer.
+class FrameQueue {
+public:
+    FrameQueue() = default;
+    
+    void configure(CameraCapture::DeliveryPolicy policy, size_t capacity, 
+                   size_t lease_budget);
+    
+    // Returns the number of frames discarded to make room
+    size_t push(const CameraCapture::FrameLease& lease);
+    
+    // Blocks until a frame is available or the queue is closed
+    bool pop(CameraCapture::FrameLease& lease);
+    
+    void close();
+    void reopen();
+    void clear();
+    
+    size_t depth() const;
+    size_t capacity() const;
+    size_t maxDepth() const;
+    
+private:
+    mutable std::mutex mutex_;
+    std::condition_variable not_empty_;
+    std::condition_variable not_full_;
+    std::deque<CameraCapture::FrameLease> frames_;
+    
+    CameraCapture::DeliveryPolicy policy_ = CameraCapture::DELIVER_LATEST;
+    size_t capacity_ = 1;
+    size_t lease_budget_ = 1;
+    size_t leased_ = 0;
+    size_t max_depth_ = 0;
+    bool closed_ = false;
+};
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <opencv2/core.hpp>
+#include "CameraCapture.h"
+
+// Recorded frames in their native capture format (raw Bayer, YUYV, MJPEG
+// bitstreams, ...) with the driver's timestamps and sequence numbers, for
+// the REPLAY backend.
+//
+// File layout, little-endian: an 8-byte magic "CAMSEQ01", then width,
+// height, pixel format, Bayer pattern and frame rate as uint32. Each frame
+// is timestamp_ns (int64), sequence (uint64), rows, cols and Mat type
+// (uint32), followed by rows * cols * elemSize bytes of pixel data. Mat
+// types are those of capture leases: CV_8UC1, CV_8UC2 (YUYV), CV_8UC3,
+// CV_16UC1 and CV_16UC3; the writer refuses others and the reader stops
+// at them.
+class FrameSequenceWriter {
+public:
+    bool open(const std::string& filename, int width, int height,
+              CameraCapture::PixelFormat format, 
+              CameraCapture::BayerPattern pattern, int fps);
+    bool write(const cv::Mat& frame, const CameraCapture::FrameMetadata& metadata);
+    void close();
+    
+    bool isOpen() const { return file_.is_open(); }
+    
+private:
+    std::ofstream file_;
+};
+
+class FrameSequenceReader {
+public:
+    bool open(const std::string& filename);
+    
+    // Reads the next frame, reusing frame's allocation when it fits.
+    // Returns false at the end of the file.
+    bool read(cv::Mat& frame, CameraCapture::FrameMetadata& metadata);
+    void rewind();
+    void close();
+    
+    bool isOpen() const { return file_.is_open(); }
+    int width() const { return width_; }
+    int height() const { return height_; }
+    int fps() const { return fps_; }
+    CameraCapture::PixelFormat pixelFormat() const { return format_; }
+    CameraCapture::BayerPattern bayerPattern() const { return pattern_; }
+    
+    static bool isSequenceFile(const std::string& filename);
+    
+private:
+    std::ifstream file_;
+    std::streampos first_frame_;
+    std::streamoff file_size_ = 0;
+    int width_ = 0;
+    int height_ = 0;
+    int fps_ = 0;
+    CameraCapture::PixelFormat format_ = CameraCapture::FORMAT_BGR24;
+    CameraCapture::BayerPattern pattern_ = CameraCapture::BAYER_BGGR;
+};
@@ -2,77 +2,305 @@
 
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
+#include "AutoWhiteBalance.h"
+#include "BayerDemosaic.h"
+#include "SpatialDenoiser.h"
+#include "TemporalDenoiser.h"
+#include "UndistortMapCache.h"
+#include "UnsharpMask.h"
+
+class ColorLUT3D;
 
 class ISPPipeline {
 public:
+    // Colour of the top-left 2x2 cell of the sensor mosaic
+    using BayerPattern = BayerDemosaic::Pattern;
+
     struct ISPParameters {
-        // Demosaic parameters
+        // Demosaic parameters. BILINEAR and MALVAR_HE_CUTLER are the
+        // in-house kernels, which also subtract the black level and apply
+        // the white balance gains; VNG and EDGE_AWARE are OpenCV's.
         enum class DemosaicMethod {
             BILINEAR = 0,
             VNG,
-            AHD
-        } demosaic_method = VNG;
+            EDGE_AWARE,
+            MALVAR_HE_CUTLER
+        } demosaic_method = DemosaicMethod::MALVAR_HE_CUTLER;
+        
+        // Raw input, used by processRaw() when the caller gives no format
+        BayerPattern bayer_pattern = BayerPattern::RGGB;
+        int raw_bit_depth = 8;
+        int black_level = 0;        // in raw units
+        
+        // Keep 16 bits per channel from the demosaic to the output, for
+        // 10/12-bit sensors: colour runs through 16-bit tables and
+        // fixed-point gains, and processRaw() returns CV_16UC3 for the
+        // caller to take to 8 bits where it displays or encodes. 16-bit
+        // frames ignore color_path (there is no per-frame stretch), VNG
+        // demosaics edge-aware and NLM denoises with the guided filter.
+        bool high_bit_depth = false;
         
         // White balance
         float wb_red = 1.0f;
         float wb_green = 1.0f;
         float wb_blue = 1.0f;
         bool auto_wb = true;
+        AutoWhiteBalance::Settings awb_settings;
         
         // Color correction matrix
         cv::Matx33f color_matrix = cv::Matx33f::eye();
         
-        // Gamma correction
+        // Gamma correction; 1 leaves the levels as they are
         float gamma = 2.2f;
-        cv::Mat gamma_lut;
         
         // Tone mapping
         float exposure = 1.0f;
         float contrast = 1.0f;
         float brightness = 0.0f;
         
-        // Noise reduction
+        // How WB, CCM, gamma and tone mapping run: stage by stage, as one
+        // fused pass, or through a 3D LUT baked from these parameters (and
+        // any grade from loadColorLUT). The LUT path has no per-frame
+        // min/max stretch, so it is deterministic for grading.
+        enum class ColorPath {
+            STAGED = 0,
+            FUSED,
+            LUT_3D
+        } color_path = ColorPath::FUSED;
+        int lut_size = 33;
+        
+        // Noise reduction. TEMPORAL is the live-video filter. GUIDED and
+        // BILATERAL_GRID are single-frame, edge-preserving and cost the
+        // same at any denoise_radius. NLM (fastNlMeans) is the slowest,
+        // highest-quality tier, for stills.
+        enum class DenoiseMode {
+            TEMPORAL = 0,
+            NLM,
+            GUIDED,
+            BILATERAL_GRID
+        } denoise_mode = DenoiseMode::TEMPORAL;
         bool denoise_enabled = true;
         float denoise_strength = 1.0f;
+        int denoise_radius = 3;
+        bool denoise_prefilter = true;
         
-        // Sharpening
+        // Unsharp mask on luma. sharpen_threshold cores the detail, in
+        // 8-bit levels, so flat noise is not sharpened with the edges.
         bool sharpen_enabled = true;
         float sharpen_strength = 0.5f;
+        int sharpen_radius = 2;         // 1 to 8
+        float sharpen_threshold = 0.0f;
+        
+        // Run the chain strip by strip across cores instead of stage by
+        // stage over the whole frame; ignored on the STAGED colour path
+        bool tiled_execution = false;
+        int tile_height = 64;
         
         // Lens correction
         cv::Mat distortion_coeffs;
         cv::Mat camera_matrix;
         bool lens_correction = false;
+        // Frame size camera_matrix was calibrated at; frames of another
+        // size, such as previews, are corrected with it scaled to theirs.
+        // Empty takes camera_matrix as it is.
+        cv::Size lens_calibration_size;
+        // < 0 keeps camera_matrix; 0..1 as in cv::getOptimalNewCameraMatrix
+        float undistort_alpha = -1.0f;
+    };
+
+    // Per-strip stage times from the last tiled frame
+    struct TileTiming {
+        int row_begin = 0;
+        int rows = 0;
+        int halo_rows = 0;
+        double lens_ms = 0.0;
+        double color_ms = 0.0;
+        double denoise_ms = 0.0;
+        double sharpen_ms = 0.0;
+        double total_ms = 0.0;
     };
 
     ISPPipeline();
     ~ISPPipeline();
 
+    // The stages run in output_rgb and in buffers kept between frames, so a
+    // caller that reuses its output Mat processes frames without
+    // reallocating them once the frame size and settings are steady.
+    // output_rgb is CV_8UC3, or CV_16UC3 with high_bit_depth for raw and
+    // 16-bit input.
     void processRaw(const cv::Mat& raw_bayer, cv::Mat& output_rgb);
+    void processRaw(const cv::Mat& raw_bayer, cv::Mat& output_rgb,
+                    BayerPattern pattern, int bit_depth);
     void processRGB(const cv::Mat& input_rgb, cv::Mat& output_rgb);
     
-    void setParameters(const ISPParameters& params) { params_ = params; }
-    ISPParameters& getParameters() { return params_; }
+    // Thread-safe. Parameters are published as an immutable, versioned
+    // snapshot that the pipeline picks up at the start of its next frame,
+    // so a change never lands partway through one and never waits for it.
+    // Neither side shares cv::Mat data with the caller's copy.
+    void setParameters(const ISPParameters& params);
+    ISPParameters getParameters() const;
+    uint64_t getParametersVersion() const;
+    
+    // Auto white balance and temporal denoise state is kept per stream; a
+    // caller interleaving frames from several cameras selects the camera first
+    void selectStream(int index) { stream_ = std::min(std::max(index, 0), kMaxStreams - 1); }
+    
+    // Gains the auto white balance has published for a stream; they are
+    // never written into the parameters
+    AutoWhiteBalance::Gains getAutoWhiteBalanceGains(int stream = 0) const;
+    
+    // Frame buffers allocated for the pipeline's stages and the caller's
+    // output: in total, and during the last frame. This is not all heap
+    // traffic: scratch inside OpenCV calls (the NLM denoiser, filters,
+    // remap, resize) and its thread pool are not counted; isp_benchmark
+    // counts those too.
+    uint64_t getBufferAllocations() const { return buffer_allocations_.load(); }
+    uint64_t getFrameBufferAllocations() const { return frame_buffer_allocations_; }
+    
+    // Empty unless the last frame ran tiled
+    const std::vector<TileTiming>& getTileTimings() const { return tile_timings_; }
     
     void calibrateWhiteBalance(const cv::Mat& gray_image);
+    // Kept for existing callers: the gamma tables are derived from gamma
+    // whenever the parameters change, so this only republishes them
     void generateGammaLUT();
     void loadColorMatrix(const std::string& filename);
     void saveColorMatrix(const std::string& filename);
+    
+    // Creative grade (.cube) applied after the colour pipeline, baked into
+    // the ColorPath::LUT_3D lattice. Safe to call while frames are running.
+    bool loadColorLUT(const std::string& filename);
+    void clearColorLUT();
 
 private:
-    void demosaicBayer(const cv::Mat& bayer, cv::Mat& rgb);
+    // Working memory for one pass through the stages: the whole frame, or
+    // one tile of it
+    struct StageBuffers {
+        cv::Mat image;      // the tile, or a copy of input that aliases output
+        cv::Mat scratch;    // second image for stages that cannot run in place
+        SpatialDenoiser spatial;
+        UnsharpMask sharpen;
+    };
+    
+    // Immutable once published
+    struct ParameterSnapshot {
+        ISPParameters params;
+        uint64_t version = 0;
+    };
+    
+    void updateParameters(const std::function<void(ISPParameters&)>& change);
+    void refreshParameters();
+    void processFrame(const cv::Mat& input_rgb, cv::Mat& output_rgb);
+    
+    void demosaicBayer(const cv::Mat& bayer, cv::Mat& rgb,
+                       BayerPattern pattern, int bit_depth);
     void applyWhiteBalance(cv::Mat& rgb);
     void applyColorCorrection(cv::Mat& rgb);
     void applyGamma(cv::Mat& rgb);
     void applyToneMapping(cv::Mat& rgb);
-    void applyDenoising(cv::Mat& rgb);
-    void applySharpening(cv::Mat& rgb);
-    void applyLensCorrection(cv::Mat& rgb);
+    void prepareColor(const cv::Mat& frame);
+    void applyColor(const cv::Mat& src, cv::Mat& dst) const;
+    void applyColor16(const cv::Mat& src, cv::Mat& dst) const;
+    void updateColorLUT();
+    void updateWhiteBalance(const cv::Mat& frame);
+    void beginDenoising(const cv::Mat& frame);
+    void applyDenoising(cv::Mat& rgb, StageBuffers& buffers,
+                        int frame_row, int update_begin, int update_end);
+    void endDenoising();
+    int bilateralGridCell() const;
+    void applySharpening(cv::Mat& rgb, StageBuffers& buffers);
+    void applyLensCorrection(const cv::Mat& src, cv::Mat& dst);
+    bool lensCorrectionEnabled() const;
+    void updateLensMaps(cv::Size size);
+    
+    void processTiled(const cv::Mat& input_rgb, cv::Mat& output_rgb);
+    int tileHalo() const;
+    void useCountingAllocator(StageBuffers& buffers);
+    void reserveOutput(cv::Mat& output, cv::Size size, int type);
     
+    // Counts what is allocated through it into buffer_allocations_; set on
+    // every buffer the pipeline owns. Declared before them, so it outlives them.
+    std::atomic<uint64_t> buffer_allocations_{0};
+    uint64_t frame_buffer_allocations_ = 0;
+    std::unique_ptr<cv::MatAllocator> buffer_allocator_;
+    
+    // Written by any thread under parameters_mutex_, read without a lock
+    std::shared_ptr<const ParameterSnapshot> published_params_;
+    mutable std::mutex parameters_mutex_;
+    
+    // The processing thread's copy of the snapshot its frame runs with.
+    // Its Mats are the snapshot's, so copying it does not copy tables.
     ISPParameters params_;
+    uint64_t params_version_ = 0;
     cv::Ptr<cv::CLAHE> clahe_;
     
     std::vector<cv::Mat> bayer_patterns_;
+    BayerDemosaic demosaic_;
+    cv::Mat demosaic_buffer_;
+    cv::Mat demosaic_wide_;     // OpenCV demosaic ahead of the level conversion
+    cv::Mat mosaic_8bit_;
+    
+    // Tables for the STAGED and FUSED colour paths. The white balance ones
+    // are per frame, from prepareColor(); the rest change with the parameters.
+    uchar wb_lut_[3][256] = {};
+    uchar gamma_lut_[256] = {};
+    uchar tone_lut_[256] = {};
+    cv::Mat color_lut_;
+    short ccm_q12_[9] = {};
+    bool ccm_enabled_ = false;
+    bool ccm_fixed_point_ = false;
+    
+    // The same for 16-bit frames: white balance gains in Q12 and a
+    // 65536-entry gamma and tone table, built only with high_bit_depth
+    uint32_t wb_q12_[3] = {};
+    std::vector<ushort> tone_lut16_;
+    
+    // Remap tables, for the parameters version and frame size they were built for
+    UndistortMapCache undistort_maps_;
+    uint64_t lens_maps_version_ = 0;
+    cv::Size lens_maps_size_;
+    
+    // Per-stream state; streams beyond the last share its slot
+    static constexpr int kMaxStreams = 8;
+    std::array<AutoWhiteBalance, kMaxStreams> white_balance_;
+    std::array<float, 3> wb_gains_ = {{ 1.0f, 1.0f, 1.0f }};
+    // Gains the demosaic already applied to this frame; wb_gains_ are
+    // what is left to apply
+    std::array<float, 3> demosaic_gains_ = {{ 1.0f, 1.0f, 1.0f }};
+    std::vector<TemporalDenoiser> temporal_denoisers_;
+    TemporalDenoiser* active_denoiser_ = nullptr;
+    int stream_ = 0;
+    
+    StageBuffers frame_buffers_;
+    std::vector<StageBuffers> tile_buffers_;
+    std::vector<TileTiming> tile_timings_;
+    
+    // Inputs of the baked lattice; a change starts a background rebuild
+    // while frames keep using the previous one
+    struct ColorLUTKey {
+        std::array<float, 16> values{};
+        uint64_t grade_generation = 0;
+        int size = 0;
+        
+        bool operator==(const ColorLUTKey& other) const {
+            return values == other.values && 
+                   grade_generation == other.grade_generation && size == other.size;
+        }
+    };
+    
+    std::shared_ptr<const ColorLUT3D> color_lut_3d_;
+    std::future<std::shared_ptr<const ColorLUT3D>> lut_build_;
+    ColorLUTKey lut_key_;
+    std::shared_ptr<const ColorLUT3D> grade_lut_;
+    std::atomic<uint64_t> grade_generation_{0};
 };
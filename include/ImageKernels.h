@@ -0,0 +1,54 @@
+#pragma once
+
+#include <algorithm>
+#include <opencv2/core.hpp>
+
+// Pieces shared by the in-house row kernels (demosaic, denoisers, unsharp
+// mask), so their borders, luma and striping agree.
+
+// Rows per stripe when a kernel streams the frame through per-stripe
+// buffers; the stripe count is capped at four per thread
+const int kStripeRows = 32;
+
+inline int rowStripes(int rows) {
+    return std::max(1, std::min((rows + kStripeRows - 1) / kStripeRows,
+                                cv::getNumThreads() * 4));
+}
+
+// Index i mirrored into [0, n) without repeating the edge sample
+// (BORDER_REFLECT_101), however far outside it is
+inline int reflectIndex(int i, int n) {
+    if (n == 1) {
+        return 0;
+    }
+    while (i < 0 || i >= n) {
+        i = i < 0 ? -i : 2 * n - 2 - i;
+    }
+    return i;
+}
+
+// Index i mirrored into [0, n) repeating the edge sample (BORDER_REFLECT)
+inline int mirrorIndex(int i, int n) {
+    while (i < 0 || i >= n) {
+        i = i < 0 ? -i - 1 : 2 * n - 1 - i;
+    }
+    return i;
+}
+
+// BT.601 luma of a BGR sample in Q8 weights, in the sample's own units
+inline int bgrLuma(const uchar* bgr) {
+    return (bgr[0] * 29 + bgr[1] * 150 + bgr[2] * 77) >> 8;
+}
+
+inline int bgrLuma(const ushort* bgr) {
+    return (bgr[0] * 29 + bgr[1] * 150 + bgr[2] * 77) >> 8;
+}
+
+// The same in 8-bit levels, for either depth
+inline int bgrLuma8(const uchar* bgr) {
+    return bgrLuma(bgr);
+}
+
+inline int bgrLuma8(const ushort* bgr) {
+    return bgrLuma(bgr) >> 8;
+}
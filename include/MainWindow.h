@@ -1,8 +1,10 @@
 #pragma once
 
 #include <QMainWindow>
-#include <QTimer>
+#include <QElapsedTimer>
 #include <memory>
+#include <vector>
+#include "CameraCapture.h"
 
 QT_BEGIN_NAMESPACE
 class QLabel;
@@ -19,7 +21,8 @@ class QGraphicsView;
 QT_END_NAMESPACE
 
 class ProcessingThread;
-class CameraCapture;
+class DeviceMonitor;
+class CaptureGroup;
 class ISPPipeline;
 class CalibrationEngine;
 
@@ -42,12 +45,17 @@ private slots:
     void onSaveCalibrationClicked();
     void onLoadCalibrationClicked();
     void onISPParameterChanged();
+    void onRawISPToggled(bool enabled);
+    void onLoadColorLUTClicked();
+    void onClearColorLUTClicked();
     
-    void onFrameProcessed(const QImage& image);
+    void onFrameProcessed(const QImage& image, qint64 capture_timestamp_ns);
     void onCalibrationFrameAdded(int count);
     void onCalibrationComplete(bool success, double error);
     void onErrorOccurred(const QString& message);
     
+    void onCameraAdded(const CameraCapture::CameraInfo& info);
+    void onCameraRemoved(int camera_id);
     void updateCameraList();
     
 private:
@@ -55,15 +63,23 @@ private:
     void setupConnections();
     void initializeCamera();
     void updateCameraControls();
+    std::string capabilityCachePath() const;
+    void releaseCaptureGroup();
     void updateISPControls();
     void saveSettings();
     void loadSettings();
+    void updateStatsLabel();
     
     // UI Components
     QLabel* display_label_ = nullptr;
+    QLabel* stats_label_ = nullptr;
     QComboBox* camera_combo_ = nullptr;
     QComboBox* resolution_combo_ = nullptr;
     QComboBox* fps_combo_ = nullptr;
+    std::vector<CameraCapture::CameraInfo> cameras_;
+    QComboBox* delivery_combo_ = nullptr;
+    QSpinBox* buffer_count_spin_ = nullptr;
+    QCheckBox* sync_group_check_ = nullptr;
     QPushButton* start_stop_button_ = nullptr;
     QPushButton* calibration_capture_button_ = nullptr;
     QPushButton* calibrate_button_ = nullptr;
@@ -82,8 +98,12 @@ private:
     QSlider* wb_blue_slider_ = nullptr;
     QCheckBox* auto_wb_check_ = nullptr;
     QCheckBox* denoise_check_ = nullptr;
+    QComboBox* denoise_mode_combo_ = nullptr;
     QCheckBox* sharpen_check_ = nullptr;
     QCheckBox* lens_correction_check_ = nullptr;
+    QCheckBox* raw_isp_check_ = nullptr;
+    QPushButton* load_lut_button_ = nullptr;
+    QPushButton* clear_lut_button_ = nullptr;
     
     // Camera and processing
     std::shared_ptr<CameraCapture> camera_;
@@ -91,7 +111,14 @@ private:
     std::shared_ptr<CalibrationEngine> calib_engine_;
     ProcessingThread* processing_thread_ = nullptr;
     
-    QTimer* camera_refresh_timer_ = nullptr;
+    DeviceMonitor* device_monitor_ = nullptr;
+    std::shared_ptr<CaptureGroup> capture_group_;
+    std::vector<std::shared_ptr<CameraCapture>> group_cameras_;
+    int preferred_camera_id_ = 0;
     
     bool is_capturing_ = false;
+    
+    // Capture-to-paint latency, smoothed, and label refresh throttle
+    double display_latency_ms_ = 0.0;
+    QElapsedTimer stats_refresh_timer_;
 };
\ No newline at end of file
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+// cv::parallel_for_ without the heap. OpenCV wraps a lambda in a
+// std::function and its thread pool allocates a job on every call, and the
+// ISP makes a dozen of these calls per frame. Here the body is called
+// through a ParallelLoopBody on the caller's stack, on a pool of workers
+// kept for the life of the process; the calling thread takes stripes too.
+// As with OpenCV, a call from inside a body, or while another thread's
+// call holds the pool, runs serially on the calling thread, and
+// cv::setNumThreads() caps the threads that take part.
+void runParallel(const cv::Range& range, const cv::ParallelLoopBody& body,
+                 double nstripes = -1.0);
+
+template <typename Body>
+class ParallelLoopAdapter : public cv::ParallelLoopBody {
+public:
+    explicit ParallelLoopAdapter(const Body& body) : body_(body) {}
+    void operator()(const cv::Range& range) const override { body_(range); }
+
+private:
+    const Body& body_;
+};
+
+template <typename Body>
+void parallelFor(const cv::Range& range, const Body& body, double nstripes = -1.0) {
+    runParallel(range, ParallelLoopAdapter<Body>(body), nstripes);
+}
@@ -5,8 +5,10 @@
 #include <QMutex>
 #include <QWaitCondition>
 #include <opencv2/core.hpp>
+#include "CameraCapture.h"
+#include "FrameQueue.h"
+#include "CaptureGroup.h"
 
-class CameraCapture;
 class ISPPipeline;
 class CalibrationEngine;
 
@@ -18,7 +20,8 @@ public:
         MODE_PREVIEW = 0,
         MODE_CALIBRATION,
         MODE_RAW_CAPTURE,
-        MODE_UNDISTORT
+        MODE_UNDISTORT,
+        MODE_RAW_ISP        // raw Bayer frames through ISPPipeline::processRaw
     };
     
     ProcessingThread(QObject* parent = nullptr);
@@ -28,7 +31,17 @@ public:
     void setISPPipeline(std::shared_ptr<ISPPipeline> isp);
     void setCalibrationEngine(std::shared_ptr<CalibrationEngine> calib);
     
+    // With two or more cameras in the group, framesets replace the single
+    // camera: each view goes through the ISP and they are shown side by side
+    void setCaptureGroup(std::shared_ptr<CaptureGroup> group);
+    
     void setProcessingMode(ProcessingMode mode);
+    
+    // Size of the display in device pixels. Frames shown there go through
+    // the ISP reduced to it (raw mosaics binned, BGR area-resized); saved
+    // and calibration frames are taken from the sensor-resolution input.
+    // An empty size runs the ISP at sensor resolution. Any thread.
+    void setPreviewSize(int width, int height);
     void setSaveDirectory(const std::string& directory);
     
     void startCapture();
@@ -38,8 +51,16 @@ public:
     
     bool isCapturing() const { return capturing_; }
     
+    // Frames waiting between the capture and processing threads
+    size_t queueDepth() const { return frame_queue_.depth(); }
+    size_t queueCapacity() const { return frame_queue_.capacity(); }
+    
+    // Called by the GUI once it has painted a frame from frameProcessed()
+    void frameDisplayed();
+    
 signals:
-    void frameProcessed(const QImage& image);
+    // capture_timestamp_ns is FrameMetadata::timestamp_ns of the source frame
+    void frameProcessed(const QImage& image, qint64 capture_timestamp_ns);
     void calibrationFrameAdded(int count);
     void calibrationComplete(bool success, double error);
     void errorOccurred(const QString& message);
@@ -48,21 +69,56 @@ protected:
     void run() override;
     
 private:
-    void processFrame(const cv::Mat& frame);
+    void onFrameAvailable(const CameraCapture::FrameLease& lease);
+    void processFrame(const cv::Mat& frame, 
+                      const CameraCapture::FrameMetadata& metadata);
+    void saveRawFrame(const cv::Mat& frame);
+    void processRawFrame(const CameraCapture::FrameLease& lease);
+    void onFrameSetAvailable(const CaptureGroup::FrameSet& set);
+    void processFrameSet(const CaptureGroup::FrameSet& set);
+    void emitFrame(const cv::Mat& processed, 
+                   const CameraCapture::FrameMetadata& metadata);
     QImage cvMatToQImage(const cv::Mat& mat);
+    cv::Size previewSize(cv::Size frame, int views) const;
+    const cv::Mat& previewInput(const cv::Mat& frame, cv::Mat& reduced, int views = 1) const;
     
     std::shared_ptr<CameraCapture> camera_;
     std::shared_ptr<ISPPipeline> isp_pipeline_;
     std::shared_ptr<CalibrationEngine> calib_engine_;
     
+    cv::Mat input_frame_;   // reused BGR conversion target
+    cv::Mat raw_frame_;     // reused unpack target for packed raw formats
+    cv::Mat output_frame_;  // reused ISP output; emitFrame copies it out
+    cv::Mat preview_frame_; // reused display-sized ISP input
+    cv::Mat preview_bayer_; // reused binned mosaic
+    
     ProcessingMode processing_mode_ = MODE_PREVIEW;
     std::string save_directory_ = "./";
     
     std::atomic<bool> capturing_{false};
     std::atomic<bool> stop_requested_{false};
+    std::atomic<int> frames_in_flight_{0};
+    std::atomic<bool> calibration_capture_requested_{false};
+    std::atomic<bool> raw_capture_requested_{false};
+    std::atomic<int> preview_width_{0};
+    std::atomic<int> preview_height_{0};
+    const int max_frames_in_flight_ = 1;
     
+    // Guards the members above and the frameset slot; never held while
+    // waiting on the camera
     QMutex mutex_;
-    QWaitCondition condition_;
+    FrameQueue frame_queue_;
+    
+    std::shared_ptr<CaptureGroup> capture_group_;
+    std::shared_ptr<CaptureGroup> running_group_;
+    QWaitCondition frame_set_ready_;
+    CaptureGroup::FrameSet pending_set_;
+    bool frame_set_pending_ = false;
+    std::vector<cv::Mat> view_frames_;  // reused per-camera conversion targets
+    std::vector<cv::Mat> view_outputs_; // reused per-camera ISP outputs
+    std::vector<cv::Mat> view_previews_; // reused per-camera display-sized inputs
+    std::shared_ptr<CameraCapture> streaming_camera_;
+    int consumer_id_ = -1;
     
     int frame_counter_ = 0;
     const int max_calibration_frames_ = 20;
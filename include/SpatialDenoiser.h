@@ -0,0 +1,60 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+// Edge-preserving single-frame denoisers for 8- or 16-bit BGR whose cost
+// per pixel does not grow with the filter radius, for stills and
+// calibration captures where the temporal filter has no history to work
+// with.
+//
+// Working buffers are kept between calls and only reallocated when the
+// image size changes. One instance must not be used by two threads at once.
+class SpatialDenoiser {
+public:
+    // Buffers are allocated through allocator when one is given
+    void setAllocator(cv::MatAllocator* allocator);
+
+    // Self-guided filter (He et al.), per channel, from box filters of
+    // radius `radius`. eps is in 8-bit levels squared at either depth:
+    // variations well below sqrt(eps) are smoothed, edges well above it
+    // kept.
+    void guidedFilter(const cv::Mat& src, cv::Mat& dst, int radius, float eps);
+
+    // Bilateral grid (Chen et al.): pixels are splatted into cells of
+    // `cell` x `cell` pixels and `range` 8-bit luma levels, the grid is
+    // blurred and sliced back with trilinear interpolation. frame_row
+    // anchors the cells to frame rows so tiles of a frame share one grid
+    // layout.
+    void bilateralGrid(const cv::Mat& src, cv::Mat& dst, int cell, int range,
+                       int frame_row = 0);
+
+    // Rows of context each filter needs around the rows it outputs
+    static int guidedFilterHalo(int radius) { return 2 * radius; }
+    static int bilateralGridHalo(int cell) { return 3 * cell; }
+
+private:
+    template <typename T>
+    void guidedFilterAs(const cv::Mat& src, cv::Mat& dst, int radius, float eps);
+    template <typename T>
+    void bilateralGridAs(const cv::Mat& src, cv::Mat& dst, int cell, int range, int frame_row);
+
+    // Mean over the (2 radius + 1)^2 window, edges mirrored, of a CV_32FC3
+    // plane into another
+    void boxMean(const cv::Mat& src, cv::Mat& dst, int radius);
+
+    // Guided filter planes, CV_32FC3
+    cv::Mat image_;
+    cv::Mat mean_;
+    cv::Mat mean_sq_;
+    cv::Mat a_;
+    cv::Mat b_;
+
+    // boxMean's column means (CV_32FC3) and running sums, a CV_64F row
+    // per stripe
+    cv::Mat columns_;
+    cv::Mat sums_;
+
+    // Bilateral grid cells, CV_32FC4 (B, G, R, weight sums)
+    cv::Mat grid_;
+    cv::Mat grid_scratch_;
+};
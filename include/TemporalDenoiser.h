@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstdint>
+#include <opencv2/core.hpp>
+
+// Motion-adaptive recursive filter for 8- or 16-bit BGR video.
+//
+// Each pixel moves from its history towards the new frame by a weight that
+// depends on how far the two differ: static areas average over several
+// frames, moving ones follow the new frame. The history is kept at 16 bits
+// (8-bit frames in Q8) so slow convergence does not stall on 8-bit
+// rounding; differences are weighed in 8-bit levels for either depth.
+// Differences are measured against a 3x3 box-filtered copy of the new
+// frame when the spatial prefilter is on, so noise alone does not look
+// like motion.
+//
+// A frame is filtered between beginFrame() and endFrame(), in one or more
+// filterRows() calls over disjoint row ranges, which may run concurrently.
+// Reads come from the previous history and writes go to the next, so
+// overlapping halo rows see the same history from every tile.
+class TemporalDenoiser {
+public:
+    struct Settings {
+        float strength = 1.0f;
+        bool spatial_prefilter = true;
+    };
+
+    // The histories are allocated through allocator when one is given
+    void setAllocator(cv::MatAllocator* allocator);
+
+    // Starts a frame; a size change drops the history
+    void beginFrame(cv::Size size, const Settings& settings);
+
+    // rows holds frame rows [frame_row, frame_row + rows.rows) and is
+    // filtered in place. Only rows [update_begin, update_end) of it are
+    // written to the history. With the prefilter on, the first and last
+    // rows of rows are only context unless they are frame edges.
+    // prefiltered receives the prefiltered rows; a caller that passes the
+    // same Mat every frame does not allocate.
+    void filterRows(cv::Mat& rows, int frame_row, int update_begin, int update_end,
+                    cv::Mat& prefiltered);
+
+    void endFrame();
+    void reset();
+
+    // Rows of context filterRows needs around the rows it outputs
+    int halo() const { return settings_.spatial_prefilter ? 1 : 0; }
+
+private:
+    template <typename T>
+    void filterRowsAs(cv::Mat& rows, int frame_row, int update_begin, int update_end,
+                      cv::Mat& prefiltered);
+
+    Settings settings_;
+    cv::Size size_;
+
+    // 16-bit histories, read from history_[read_], written to the other
+    cv::Mat history_[2];
+    int read_ = 0;
+    bool has_history_ = false;
+
+    // Weight of the new frame in Q8, indexed by the summed channel difference
+    uint16_t weight_lut_[766] = {};
+};
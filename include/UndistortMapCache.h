@@ -0,0 +1,44 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+// Fixed-point undistortion tables for one calibration at one image size.
+//
+// cv::undistort rebuilds the full distortion map on every call; this builds
+// CV_16SC2 remap tables once and reuses them until the camera matrix,
+// distortion coefficients, image size or alpha change. Not thread-safe;
+// each consumer keeps its own.
+class UndistortMapCache {
+public:
+    // alpha < 0 keeps camera_matrix as the output projection; otherwise it
+    // is passed to cv::getOptimalNewCameraMatrix (0 crops to valid pixels,
+    // 1 keeps every source pixel). dst must not alias src.
+    void undistort(const cv::Mat& src, cv::Mat& dst,
+                   const cv::Mat& camera_matrix, const cv::Mat& distortion_coeffs,
+                   double alpha = -1.0);
+    
+    // Rebuilds the tables if any input changed
+    void update(const cv::Mat& camera_matrix, const cv::Mat& distortion_coeffs,
+                cv::Size size, double alpha = -1.0);
+    
+    // Output rows [row_begin, row_end) from the whole src, after update();
+    // safe to call concurrently for different rows
+    void remapRows(const cv::Mat& src, cv::Mat& dst, int row_begin, int row_end) const;
+    
+    void invalidate();
+    
+    const cv::Mat& newCameraMatrix() const { return new_camera_matrix_; }
+    
+private:
+    bool matches(const cv::Mat& camera_matrix, const cv::Mat& distortion_coeffs,
+                 cv::Size size, double alpha) const;
+    
+    cv::Mat camera_matrix_;
+    cv::Mat distortion_coeffs_;
+    cv::Size size_;
+    double alpha_ = -1.0;
+    
+    cv::Mat new_camera_matrix_;
+    cv::Mat map_xy_;
+    cv::Mat map_interp_;
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <opencv2/core.hpp>
+
+// Unsharp mask on luma for 8- or 16-bit BGR.
+//
+// Luma is blurred with a separable Gaussian in Q14 fixed point, and the
+// cored difference between luma and its blur, times the amount, is added
+// to B, G and R alike. That moves luma by the difference and leaves the
+// chroma alone, at a third of the filtering of a per-channel mask. It
+// takes two passes over the frame: the first computes luma, the second
+// runs the vertical and horizontal blur, the weighting and the clamp row
+// by row.
+//
+// Working buffers are kept between calls. One instance must not be used
+// by two threads at once.
+class UnsharpMask {
+public:
+    struct Settings {
+        int radius = 2;             // kernel taps each side, 1 to 8
+        float amount = 0.5f;        // of the detail added back
+        float threshold = 0.0f;     // coring: detail up to this (8-bit levels) is left alone
+    };
+
+    // Buffers are allocated through allocator when one is given
+    void setAllocator(cv::MatAllocator* allocator);
+
+    // Sharpens bgr (CV_8UC3 or CV_16UC3) in place; its edges are mirrored
+    void apply(cv::Mat& bgr, const Settings& settings);
+
+    // Rows of context apply needs around the rows it outputs
+    static int halo(int radius);
+
+private:
+    cv::Mat luma_;      // CV_32S luma of the frame
+    cv::Mat rows_;      // CV_32S vertical and horizontal blur rows, two per stripe
+};
@@ -27,6 +27,7 @@ if [ "$OS" = "ubuntu" ] || [ "$OS" = "debian" ]; then
         qt6-multimediawidgets-dev \
         libopencv-dev \
         libv4l-dev \
+        libturbojpeg0-dev \
         libtbb-dev \
         pkg-config
     
@@ -52,6 +53,7 @@ elif [ "$OS" = "fedora" ]; then
         qt6-qtmultimedia-devel \
         opencv-devel \
         v4l-utils-devel \
+        turbojpeg-devel \
         tbb-devel
 
 # Arch Linux
@@ -65,6 +67,7 @@ elif [ "$OS" = "arch" ] || [ "$OS" = "manjaro" ]; then
         qt6-multimedia \
         opencv \
         v4l-utils \
+        libjpeg-turbo \
         tbb
 
 # OpenSUSE
@@ -78,6 +81,7 @@ elif [ "$OS" = "opensuse-tumbleweed" ] || [ "$OS" = "opensuse-leap" ]; then
         libqt6-qtmultimedia-devel \
         opencv-devel \
         v4l-utils-devel \
+        libturbojpeg0-devel \
         tbb-devel
 
 else
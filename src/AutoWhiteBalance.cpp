@@ -0,0 +1,154 @@
+#include "AutoWhiteBalance.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+// Below this every channel is mostly noise
+const int kDarkLevel = 8;
+const int kMinSamples = 64;
+
+// Fraction of samples, brightest first, that WHITE_PATCH averages
+const double kWhitePatchFraction = 0.02;
+
+inline int level8(uchar v) { return v; }
+inline int level8(ushort v) { return v >> 8; }
+
+// Channel sums per luma level over the sampling grid, in 8-bit levels for
+// either sample depth; returns the number of samples taken
+template <typename T>
+int gatherLevels(const cv::Mat& bgr, int step, int saturation,
+                 double sums[256][3], int counts[256]) {
+    int samples = 0;
+    for (int y = step / 2; y < bgr.rows; y += step) {
+        const T* row = bgr.ptr<T>(y);
+        for (int x = step / 2; x < bgr.cols; x += step) {
+            const T* t = row + x * 3;
+            const int px[3] = { level8(t[0]), level8(t[1]), level8(t[2]) };
+            const int hi = std::max(px[0], std::max(px[1], px[2]));
+            if (hi >= saturation || hi < kDarkLevel) {
+                continue;
+            }
+            const int level = (px[0] * 29 + px[1] * 150 + px[2] * 77) >> 8;
+            sums[level][0] += px[0];
+            sums[level][1] += px[1];
+            sums[level][2] += px[2];
+            counts[level]++;
+            samples++;
+        }
+    }
+    return samples;
+}
+
+} // namespace
+
+void AutoWhiteBalance::setSettings(const Settings& settings) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    settings_ = settings;
+}
+
+bool AutoWhiteBalance::update(const cv::Mat& bgr, const Gains& applied) {
+    if (bgr.empty() || (bgr.type() != CV_8UC3 && bgr.type() != CV_16UC3)) {
+        return false;
+    }
+
+    Settings settings;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        settings = settings_;
+    }
+    if (frame_count_++ % static_cast<uint64_t>(std::max(settings.interval, 1)) != 0) {
+        return false;
+    }
+
+    Gains target;
+    if (!estimate(bgr, applied, target)) {
+        return false;
+    }
+
+    // The first estimate is taken as is so start-up does not fade in
+    if (!converged_once_) {
+        smoothed_ = target;
+        converged_once_ = true;
+    } else {
+        const float k = std::min(std::max(settings.smoothing, 0.0f), 1.0f);
+        smoothed_.blue += k * (target.blue - smoothed_.blue);
+        smoothed_.green += k * (target.green - smoothed_.green);
+        smoothed_.red += k * (target.red - smoothed_.red);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto changed = [&](float published, float value) {
+        return std::abs(value - published) > settings.deadband * published;
+    };
+    if (!changed(gains_.blue, smoothed_.blue) && !changed(gains_.green, smoothed_.green) &&
+        !changed(gains_.red, smoothed_.red)) {
+        return false;
+    }
+    gains_ = smoothed_;
+    return true;
+}
+
+bool AutoWhiteBalance::estimate(const cv::Mat& bgr, const Gains& applied,
+                                Gains& target) const {
+    Settings settings;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        settings = settings_;
+    }
+    const int step = std::max(settings.step, 1);
+
+    // Channel sums per luma level, so both methods come from one pass
+    double sums[256][3] = {};
+    int counts[256] = {};
+    const int samples = bgr.depth() == CV_8U
+        ? gatherLevels<uchar>(bgr, step, settings.saturation, sums, counts)
+        : gatherLevels<ushort>(bgr, step, settings.saturation, sums, counts);
+    if (samples < kMinSamples) {
+        return false;
+    }
+
+    int lowest_level = 0;
+    if (settings.method == WHITE_PATCH) {
+        const int wanted = std::max(1, static_cast<int>(samples * kWhitePatchFraction));
+        int taken = 0;
+        lowest_level = 255;
+        while (lowest_level > 0 && taken + counts[lowest_level] < wanted) {
+            taken += counts[lowest_level--];
+        }
+    }
+
+    double mean[3] = {};
+    for (int level = lowest_level; level < 256; ++level) {
+        for (int c = 0; c < 3; ++c) {
+            mean[c] += sums[level][c];
+        }
+    }
+    if (mean[0] <= 0.0 || mean[1] <= 0.0 || mean[2] <= 0.0) {
+        return false;
+    }
+
+    // Back to the colour the sensor saw
+    mean[0] /= applied.blue;
+    mean[1] /= applied.green;
+    mean[2] /= applied.red;
+
+    const double avg = (mean[0] + mean[1] + mean[2]) / 3.0;
+    target.blue = static_cast<float>(avg / mean[0]);
+    target.green = static_cast<float>(avg / mean[1]);
+    target.red = static_cast<float>(avg / mean[2]);
+    return true;
+}
+
+AutoWhiteBalance::Gains AutoWhiteBalance::gains() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return gains_;
+}
+
+void AutoWhiteBalance::reset(const Gains& gains) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    gains_ = gains;
+    smoothed_ = gains;
+    frame_count_ = 0;
+    converged_once_ = false;
+}
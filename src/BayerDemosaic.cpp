@@ -0,0 +1,325 @@
+#include "BayerDemosaic.h"
+#include "ImageKernels.h"
+#include "ParallelFor.h"
+#include <algorithm>
+#include <opencv2/core/hal/intrin.hpp>
+
+namespace {
+
+// An interpolated value as weights of the centre sample and of sums of its
+// neighbours in the 5x5 window: horizontal and vertical at distance one
+// and two, and the four diagonals. The weights of a value sum to 16.
+struct Taps {
+    int c, h1, h2, v1, v2, diag;
+};
+
+// The two colours a pixel lacks. At a red or blue site: green, and the
+// colour on its diagonals. At a green site: the colour beside it in its
+// row, and the colour above and below it.
+struct Filter {
+    Taps green;
+    Taps diagonal;
+    Taps horizontal;
+    Taps vertical;
+};
+
+const Filter kBilinear = {
+    { 0, 4,  0, 4,  0, 0 },
+    { 0, 0,  0, 0,  0, 4 },
+    { 0, 8,  0, 0,  0, 0 },
+    { 0, 0,  0, 8,  0, 0 }
+};
+
+// The paper's filters in eighths, doubled so the half weights are integers
+const Filter kMalvarHeCutler = {
+    {  8, 4, -2, 4, -2,  0 },
+    { 12, 0, -3, 0, -3,  4 },
+    { 10, 8, -2, 0,  1, -2 },
+    { 10, 0,  1, 8, -2, -2 }
+};
+
+const int kPad = 2;                     // window radius
+const int kRingRows = 2 * kPad + 1;
+
+// Normalization and layout of the rows of one parity
+struct RowSetup {
+    bool red_row;       // holds red samples, not blue
+    int site;           // column parity of its red or blue samples
+    float scale[2];     // by column parity: gain, black level and range
+    float offset[2];
+};
+
+inline int weigh(const Taps& t, int c, int h1, int h2, int v1, int v2, int diag) {
+    return t.c * c + t.h1 * h1 + t.h2 * h2 + t.v1 * v1 + t.v2 * v2 + t.diag * diag;
+}
+
+#if CV_SIMD
+inline cv::v_int32 loadInt32(const uchar* p) {
+    return cv::v_reinterpret_as_s32(cv::vx_load_expand_q(p));
+}
+
+inline cv::v_int32 loadInt32(const ushort* p) {
+    return cv::v_reinterpret_as_s32(cv::vx_load_expand(p));
+}
+
+inline cv::v_int32 weigh(const Taps& t, const cv::v_int32& c, const cv::v_int32& h1,
+                         const cv::v_int32& h2, const cv::v_int32& v1,
+                         const cv::v_int32& v2, const cv::v_int32& diag) {
+    return cv::vx_setall_s32(t.c) * c + cv::vx_setall_s32(t.h1) * h1 +
+           cv::vx_setall_s32(t.h2) * h2 + cv::vx_setall_s32(t.v1) * v1 +
+           cv::vx_setall_s32(t.v2) * v2 + cv::vx_setall_s32(t.diag) * diag;
+}
+
+// B, G and R of the pixels from x, before rounding; lane parity is column
+// parity, since x is even
+inline void interpolate(const int* const rows[kRingRows], int x, const Filter& f,
+                        const cv::v_int32& site, bool red_row, int shift,
+                        cv::v_int32& b, cv::v_int32& g, cv::v_int32& r) {
+    const int* p0 = rows[0];
+    const int* p1 = rows[1];
+    const int* p2 = rows[2];
+    const int* p3 = rows[3];
+    const int* p4 = rows[4];
+
+    const cv::v_int32 c = cv::vx_load(p2 + x);
+    const cv::v_int32 h1 = cv::vx_load(p2 + x - 1) + cv::vx_load(p2 + x + 1);
+    const cv::v_int32 h2 = cv::vx_load(p2 + x - 2) + cv::vx_load(p2 + x + 2);
+    const cv::v_int32 v1 = cv::vx_load(p1 + x) + cv::vx_load(p3 + x);
+    const cv::v_int32 v2 = cv::vx_load(p0 + x) + cv::vx_load(p4 + x);
+    const cv::v_int32 diag = cv::vx_load(p1 + x - 1) + cv::vx_load(p1 + x + 1) +
+                             cv::vx_load(p3 + x - 1) + cv::vx_load(p3 + x + 1);
+    const cv::v_int32 own_sample = c << 4;
+
+    const cv::v_int32 own = cv::v_select(site, own_sample, weigh(f.horizontal, c, h1, h2, v1, v2, diag));
+    const cv::v_int32 green = cv::v_select(site, weigh(f.green, c, h1, h2, v1, v2, diag), own_sample);
+    const cv::v_int32 other = cv::v_select(site, weigh(f.diagonal, c, h1, h2, v1, v2, diag),
+                                           weigh(f.vertical, c, h1, h2, v1, v2, diag));
+
+    const cv::v_int32 half = cv::vx_setall_s32(1 << (shift - 1));
+    g = (green + half) >> shift;
+    b = ((red_row ? other : own) + half) >> shift;
+    r = ((red_row ? own : other) + half) >> shift;
+}
+#endif
+
+// Black level, gain and range of one raw row, clipped at white, mirrored by
+// two pixels at each end
+template <typename T>
+void normalizeRow(const T* src, int* dst, int width, const RowSetup& setup, int white) {
+    int x = 0;
+#if CV_SIMD
+    const int lanes = cv::v_int32::nlanes;
+    float scale[cv::v_float32::nlanes];
+    float offset[cv::v_float32::nlanes];
+    for (int i = 0; i < lanes; ++i) {
+        scale[i] = setup.scale[i & 1];
+        offset[i] = setup.offset[i & 1];
+    }
+    const cv::v_float32 v_scale = cv::vx_load(scale);
+    const cv::v_float32 v_offset = cv::vx_load(offset);
+    const cv::v_int32 zero = cv::vx_setzero_s32();
+    const cv::v_int32 top = cv::vx_setall_s32(white);
+    for (; x <= width - lanes; x += lanes) {
+        cv::v_int32 v = cv::v_round(cv::v_muladd(cv::v_cvt_f32(loadInt32(src + x)), v_scale, v_offset));
+        cv::v_store(dst + x, cv::v_min(cv::v_max(v, zero), top));
+    }
+#endif
+    for (; x < width; ++x) {
+        int v = cvRound(src[x] * setup.scale[x & 1] + setup.offset[x & 1]);
+        dst[x] = std::min(std::max(v, 0), white);
+    }
+
+    dst[-1] = dst[1];
+    dst[-2] = dst[2];
+    dst[width] = dst[width - 2];
+    dst[width + 1] = dst[width - 3];
+}
+
+template <typename U>
+void demosaicRow(const int* const rows[kRingRows], U* dst, int width, const Filter& f,
+                 const RowSetup& setup, int shift) {
+    int x = 0;
+#if CV_SIMD
+    const int lanes = cv::v_int32::nlanes;
+    int site_mask[cv::v_int32::nlanes];
+    for (int i = 0; i < lanes; ++i) {
+        site_mask[i] = (i & 1) == setup.site ? -1 : 0;
+    }
+    const cv::v_int32 site = cv::vx_load(site_mask);
+
+    // Four int32 vectors per 8-bit store, two per 16-bit one
+    constexpr int groups = sizeof(U) == 1 ? 4 : 2;
+    for (; x <= width - lanes * groups; x += lanes * groups) {
+        cv::v_int32 b[4], g[4], r[4];
+        for (int k = 0; k < groups; ++k) {
+            interpolate(rows, x + k * lanes, f, site, setup.red_row, shift, b[k], g[k], r[k]);
+        }
+        if constexpr (sizeof(U) == 1) {
+            cv::v_store_interleave(reinterpret_cast<uchar*>(dst) + x * 3,
+                                   cv::v_pack_u(cv::v_pack(b[0], b[1]), cv::v_pack(b[2], b[3])),
+                                   cv::v_pack_u(cv::v_pack(g[0], g[1]), cv::v_pack(g[2], g[3])),
+                                   cv::v_pack_u(cv::v_pack(r[0], r[1]), cv::v_pack(r[2], r[3])));
+        } else {
+            cv::v_store_interleave(reinterpret_cast<ushort*>(dst) + x * 3,
+                                   cv::v_pack_u(b[0], b[1]), cv::v_pack_u(g[0], g[1]),
+                                   cv::v_pack_u(r[0], r[1]));
+        }
+    }
+#endif
+    const int* p0 = rows[0];
+    const int* p1 = rows[1];
+    const int* p2 = rows[2];
+    const int* p3 = rows[3];
+    const int* p4 = rows[4];
+    const int half = 1 << (shift - 1);
+    for (; x < width; ++x) {
+        const int c = p2[x];
+        const int h1 = p2[x - 1] + p2[x + 1];
+        const int h2 = p2[x - 2] + p2[x + 2];
+        const int v1 = p1[x] + p3[x];
+        const int v2 = p0[x] + p4[x];
+        const int diag = p1[x - 1] + p1[x + 1] + p3[x - 1] + p3[x + 1];
+
+        int own, green, other;
+        if ((x & 1) == setup.site) {
+            own = c << 4;
+            green = weigh(f.green, c, h1, h2, v1, v2, diag);
+            other = weigh(f.diagonal, c, h1, h2, v1, v2, diag);
+        } else {
+            own = weigh(f.horizontal, c, h1, h2, v1, v2, diag);
+            green = c << 4;
+            other = weigh(f.vertical, c, h1, h2, v1, v2, diag);
+        }
+
+        U* px = dst + x * 3;
+        px[0] = cv::saturate_cast<U>(((setup.red_row ? other : own) + half) >> shift);
+        px[1] = cv::saturate_cast<U>((green + half) >> shift);
+        px[2] = cv::saturate_cast<U>(((setup.red_row ? own : other) + half) >> shift);
+    }
+}
+
+// One row of a binned mosaic: each sample averages factor x factor samples
+// of its colour, taken from the CFA cells its own cell covers
+template <typename T>
+void binRow(const cv::Mat& bayer, T* dst, int y, int width, int factor) {
+    const int area = factor * factor;
+    const int first_row = (y >> 1) * factor * 2 + (y & 1);
+    for (int x = 0; x < width; ++x) {
+        const int first_col = (x >> 1) * factor * 2 + (x & 1);
+        uint32_t sum = 0;
+        for (int i = 0; i < factor; ++i) {
+            const T* src = bayer.ptr<T>(first_row + i * 2) + first_col;
+            for (int j = 0; j < factor; ++j) {
+                sum += src[j * 2];
+            }
+        }
+        dst[x] = static_cast<T>((sum + area / 2) / area);
+    }
+}
+
+} // namespace
+
+void BayerDemosaic::bin(const cv::Mat& bayer, cv::Mat& binned, int factor) {
+    CV_Assert(bayer.type() == CV_8UC1 || bayer.type() == CV_16UC1);
+    factor = std::max(factor, 1);
+    const int width = bayer.cols / (2 * factor) * 2;
+    const int height = bayer.rows / (2 * factor) * 2;
+    binned.create(height, width, bayer.type());
+
+    parallelFor(cv::Range(0, height), [&](const cv::Range& range) {
+        for (int y = range.start; y < range.end; ++y) {
+            if (bayer.depth() == CV_8U) {
+                binRow(bayer, binned.ptr<uchar>(y), y, width, factor);
+            } else {
+                binRow(bayer, binned.ptr<ushort>(y), y, width, factor);
+            }
+        }
+    });
+}
+
+void BayerDemosaic::process(const cv::Mat& bayer, cv::Mat& bgr, const Settings& settings) {
+    CV_Assert((bayer.type() == CV_8UC1 || bayer.type() == CV_16UC1) &&
+              bayer.rows >= 4 && bayer.cols >= 4);
+    CV_Assert(settings.output_depth == CV_8U || settings.output_depth == CV_16U);
+    bgr.create(bayer.size(), CV_MAKETYPE(settings.output_depth, 3));
+
+    const Filter& filter = settings.method == BILINEAR ? kBilinear : kMalvarHeCutler;
+
+    // Samples are worked on scaled to white, 255 << 8 for 8-bit output so
+    // that white lands exactly on 255; sums are in sixteenths of that
+    const bool to_8bit = settings.output_depth == CV_8U;
+    const int white = to_8bit ? 255 << 8 : 65535;
+    const int shift = to_8bit ? 12 : 4;
+
+    const int input_max = bayer.depth() == CV_8U ? 255 :
+                          (1 << std::min(std::max(settings.bit_depth, 8), 16)) - 1;
+    const int black = std::min(std::max(settings.black_level, 0), input_max - 1);
+    const float to_working = static_cast<float>(white) / (input_max - black);
+
+    // Red sits at (red_y, red_x) of each 2x2 cell, blue opposite it
+    int red_y = 0;
+    int red_x = 0;
+    switch (settings.pattern) {
+        case Pattern::BGGR: red_y = 1; red_x = 1; break;
+        case Pattern::GBRG: red_y = 1; red_x = 0; break;
+        case Pattern::GRBG: red_y = 0; red_x = 1; break;
+        case Pattern::RGGB: break;
+    }
+
+    RowSetup setups[2];
+    for (int py = 0; py < 2; ++py) {
+        RowSetup& setup = setups[py];
+        setup.red_row = py == red_y;
+        setup.site = setup.red_row ? red_x : 1 - red_x;
+        for (int px = 0; px < 2; ++px) {
+            float gain = settings.gain_green;
+            if (px == setup.site) {
+                gain = setup.red_row ? settings.gain_red : settings.gain_blue;
+            }
+            setup.scale[px] = gain * to_working;
+            setup.offset[px] = -black * setup.scale[px];
+        }
+    }
+
+    // Each stripe streams its rows through its own ring of normalized rows
+    const int stripes = rowStripes(bayer.rows);
+    const int stride = bayer.cols + 2 * kPad;
+    rings_.create(stripes * kRingRows, stride, CV_32SC1);
+
+    parallelFor(cv::Range(0, stripes), [&](const cv::Range& range) {
+        for (int stripe = range.start; stripe < range.end; ++stripe) {
+            const int y_begin = bayer.rows * stripe / stripes;
+            const int y_end = bayer.rows * (stripe + 1) / stripes;
+            int held[kRingRows];
+            std::fill(held, held + kRingRows, -1);
+
+            for (int y = y_begin; y < y_end; ++y) {
+                // A window of five rows, mirrored at the frame edges, never
+                // needs two source rows that share a slot
+                const int* rows[kRingRows];
+                for (int k = 0; k < kRingRows; ++k) {
+                    const int source = reflectIndex(y + k - kPad, bayer.rows);
+                    const int slot = source % kRingRows;
+                    int* line = rings_.ptr<int>(stripe * kRingRows + slot) + kPad;
+                    if (held[slot] != source) {
+                        if (bayer.depth() == CV_8U) {
+                            normalizeRow(bayer.ptr<uchar>(source), line, bayer.cols,
+                                         setups[source & 1], white);
+                        } else {
+                            normalizeRow(bayer.ptr<ushort>(source), line, bayer.cols,
+                                         setups[source & 1], white);
+                        }
+                        held[slot] = source;
+                    }
+                    rows[k] = line;
+                }
+
+                if (to_8bit) {
+                    demosaicRow(rows, bgr.ptr<uchar>(y), bayer.cols, filter, setups[y & 1], shift);
+                } else {
+                    demosaicRow(rows, bgr.ptr<ushort>(y), bayer.cols, filter, setups[y & 1], shift);
+                }
+            }
+        }
+    }, stripes);
+}
@@ -164,14 +164,14 @@ void CalibrationEngine::drawChessboardCorners(cv::Mat& image,
                              cv::Mat(corners), pattern_found);
 }
 
-void CalibrationEngine::undistortImage(const cv::Mat& input, cv::Mat& output) {
+void CalibrationEngine::undistortImage(const cv::Mat& input, cv::Mat& output, double alpha) {
     if (!calibrated_ || input.empty()) {
         output = input.clone();
         return;
     }
     
-    cv::undistort(input, output, result_.camera_matrix, 
-                 result_.distortion_coeffs);
+    undistort_maps_.undistort(input, output, result_.camera_matrix, 
+                              result_.distortion_coeffs, alpha);
 }
 
 bool CalibrationEngine::saveCalibration(const std::string& filename) {
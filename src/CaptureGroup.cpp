@@ -0,0 +1,337 @@
+#include "CaptureGroup.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <limits>
+
+#ifndef _WIN32
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+int64_t monotonicNowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+} // namespace
+
+CaptureGroup::CaptureGroup() {}
+
+CaptureGroup::~CaptureGroup() {
+    stop();
+}
+
+int CaptureGroup::addCamera(std::shared_ptr<CameraCapture> camera) {
+    if (running_ || !camera || !camera->isInitialized()) {
+        return -1;
+    }
+    
+    // OpenCV and DirectShow frames are waited for, which would stall the
+    // reactor and every other camera on it
+    const CameraCapture::CaptureBackend backend = camera->getBackend();
+    if (backend == CameraCapture::OPENCV || backend == CameraCapture::DSHOW) {
+        return -1;
+    }
+    
+    Member member;
+    member.camera = camera;
+    members_.push_back(member);
+    return static_cast<int>(members_.size()) - 1;
+}
+
+void CaptureGroup::clear() {
+    if (running_) {
+        return;
+    }
+    members_.clear();
+}
+
+std::shared_ptr<CameraCapture> CaptureGroup::camera(size_t index) const {
+    return index < members_.size() ? members_[index].camera : nullptr;
+}
+
+void CaptureGroup::setFrameSetCallback(FrameSetCallback callback) {
+    if (running_) {
+        return;
+    }
+    callback_ = std::move(callback);
+}
+
+bool CaptureGroup::start() {
+#ifdef _WIN32
+    return false;
+#else
+    if (running_) {
+        return true;
+    }
+    if (members_.empty()) {
+        return false;
+    }
+    for (const auto& member : members_) {
+        if (!member.camera->isInitialized() || member.camera->isStreaming()) {
+            return false;
+        }
+    }
+    
+    stop_event_fd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (stop_event_fd_ < 0) {
+        return false;
+    }
+    
+    next_sequence_ = 0;
+    running_ = true;
+    reactor_thread_ = std::thread([this]() { reactorLoop(); });
+    return true;
+#endif
+}
+
+void CaptureGroup::stop() {
+#ifndef _WIN32
+    if (!running_ && !reactor_thread_.joinable()) {
+        return;
+    }
+    
+    running_ = false;
+    if (stop_event_fd_ >= 0) {
+        uint64_t one = 1;
+        ssize_t written = write(stop_event_fd_, &one, sizeof(one));
+        (void)written;
+    }
+    
+    if (reactor_thread_.joinable()) {
+        reactor_thread_.join();
+    }
+    
+    if (stop_event_fd_ >= 0) {
+        close(stop_event_fd_);
+        stop_event_fd_ = -1;
+    }
+    
+    // Give the drivers their buffers back
+    for (auto& member : members_) {
+        member.pending.clear();
+        member.fd = -1;
+    }
+#endif
+}
+
+CaptureGroup::SyncStats CaptureGroup::getStats() const {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    return stats_;
+}
+
+void CaptureGroup::resetStats() {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_ = SyncStats();
+}
+
+#ifndef _WIN32
+void CaptureGroup::reactorLoop() {
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        running_ = false;
+        return;
+    }
+    
+    epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u64 = std::numeric_limits<uint64_t>::max();
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_event_fd_, &event);
+    
+    for (size_t i = 0; i < members_.size(); ++i) {
+        Member& member = members_[i];
+        member.fd = member.camera->pollFd();
+        if (member.fd >= 0) {
+            event.data.u64 = i;
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, member.fd, &event);
+        }
+    }
+    
+    std::vector<epoll_event> events(members_.size() + 1);
+    while (running_) {
+        // Wake up in time to flush framesets a camera never completes;
+        // members without an fd (or restarting) are polled
+        bool waiting = false;
+        bool backing_off = false;
+        bool has_polled_members = false;
+        for (const auto& member : members_) {
+            waiting |= !member.pending.empty();
+            backing_off |= member.resume_ns > 0;
+            has_polled_members |= member.fd < 0;
+        }
+        int timeout_ms = -1;
+        if (has_polled_members || backing_off) {
+            timeout_ms = 2;
+        } else if (waiting) {
+            timeout_ms = static_cast<int>(std::max<int64_t>(missing_timeout_ns_ / 4000000, 1));
+        }
+        
+        int count = epoll_wait(epoll_fd, events.data(), static_cast<int>(events.size()), 
+                               timeout_ms);
+        if (count < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        
+        int64_t now_ns = monotonicNowNs();
+        bool stop = false;
+        for (int i = 0; i < count && !stop; ++i) {
+            uint64_t index = events[i].data.u64;
+            if (index >= members_.size()) {
+                stop = true;
+                break;
+            }
+            
+            Member& member = members_[index];
+            size_t before = member.pending.size();
+            serviceCamera(member, epoll_fd);
+            
+            // vb2 signals EPOLLERR while all buffers are out; back off
+            if ((events[i].events & (EPOLLERR | EPOLLHUP)) && 
+                member.pending.size() == before && member.fd >= 0) {
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, member.fd, nullptr);
+                member.resume_ns = now_ns + 2000000;
+            }
+        }
+        if (stop) break;
+        
+        for (size_t i = 0; i < members_.size(); ++i) {
+            Member& member = members_[i];
+            if (member.fd < 0) {
+                serviceCamera(member, epoll_fd);
+            } else if (member.resume_ns > 0 && now_ns >= member.resume_ns) {
+                member.resume_ns = 0;
+                event.data.u64 = i;
+                epoll_ctl(epoll_fd, EPOLL_CTL_ADD, member.fd, &event);
+            }
+        }
+        
+        matchFrameSets(now_ns);
+    }
+    
+    close(epoll_fd);
+}
+
+void CaptureGroup::serviceCamera(Member& member, int epoll_fd) {
+    CameraCapture::FrameLease lease;
+    while (member.camera->pollFrame(lease)) {
+        member.pending.push_back(lease);
+        lease.release();
+        
+        // Do not starve the driver of buffers while waiting on a partner
+        if (member.pending.size() > max_pending_) {
+            member.pending.pop_front();
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            stats_.unmatched_frames++;
+        }
+        
+        // Without an fd there is no telling when the backend runs dry;
+        // one frame per pass keeps the others serviced
+        if (member.fd < 0) {
+            break;
+        }
+    }
+    
+    if (member.camera->restartPending()) {
+        // A control change needs a new stream: hand our leases back and
+        // poll until the camera has reopened it
+        {
+            std::lock_guard<std::mutex> lock(stats_mutex_);
+            stats_.unmatched_frames += member.pending.size();
+        }
+        member.pending.clear();
+        if (member.fd >= 0 && member.resume_ns == 0) {
+            epoll_ctl(epoll_fd, EPOLL_CTL_DEL, member.fd, nullptr);
+        }
+        member.fd = -1;
+        member.resume_ns = 0;
+        return;
+    }
+    
+    if (member.fd < 0) {
+        member.fd = member.camera->pollFd();
+        if (member.fd >= 0) {
+            epoll_event event;
+            memset(&event, 0, sizeof(event));
+            event.events = EPOLLIN;
+            event.data.u64 = static_cast<uint64_t>(&member - members_.data());
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, member.fd, &event);
+        }
+    }
+}
+#else
+void CaptureGroup::reactorLoop() {}
+void CaptureGroup::serviceCamera(Member&, int) {}
+#endif
+
+void CaptureGroup::matchFrameSets(int64_t now_ns) {
+    while (true) {
+        // The oldest waiting frame anchors the next set
+        int64_t oldest = std::numeric_limits<int64_t>::max();
+        for (const auto& member : members_) {
+            if (!member.pending.empty()) {
+                oldest = std::min(oldest, member.pending.front().metadata().timestamp_ns);
+            }
+        }
+        if (oldest == std::numeric_limits<int64_t>::max()) {
+            return;
+        }
+        
+        // A camera is missing from this set if its next frame is already
+        // past the window; it is still pending if it has nothing queued
+        size_t matched = 0;
+        bool still_pending = false;
+        for (const auto& member : members_) {
+            if (member.pending.empty()) {
+                still_pending = true;
+            } else if (member.pending.front().metadata().timestamp_ns <= oldest + tolerance_ns_) {
+                matched++;
+            }
+        }
+        
+        bool complete = matched == members_.size();
+        if (!complete && still_pending && now_ns - oldest < missing_timeout_ns_) {
+            return;
+        }
+        
+        FrameSet set;
+        set.frames.resize(members_.size());
+        set.complete = complete;
+        set.timestamp_ns = oldest;
+        int64_t latest = oldest;
+        for (size_t i = 0; i < members_.size(); ++i) {
+            Member& member = members_[i];
+            if (!member.pending.empty() && 
+                member.pending.front().metadata().timestamp_ns <= oldest + tolerance_ns_) {
+                set.frames[i] = member.pending.front();
+                latest = std::max(latest, set.frames[i].metadata().timestamp_ns);
+                member.pending.pop_front();
+            }
+        }
+        set.skew_ns = latest - oldest;
+        
+        emitFrameSet(set);
+    }
+}
+
+void CaptureGroup::emitFrameSet(FrameSet& set) {
+    set.sequence = next_sequence_++;
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_.framesets++;
+        if (!set.complete) {
+            stats_.incomplete++;
+        }
+        stats_.max_skew_ns = std::max(stats_.max_skew_ns, set.skew_ns);
+    }
+    
+    if (callback_) {
+        callback_(set);
+    }
+}
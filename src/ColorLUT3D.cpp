@@ -0,0 +1,213 @@
+#include "ColorLUT3D.h"
+#include "ParallelFor.h"
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <sstream>
+
+namespace {
+
+// Orders the three axes by descending fraction; the tetrahedron containing
+// the sample walks from the base node along them in that order
+template <typename T>
+void sortAxes(const T frac[3], int order[3]) {
+    order[0] = 0;
+    order[1] = 1;
+    order[2] = 2;
+    if (frac[order[0]] < frac[order[1]]) std::swap(order[0], order[1]);
+    if (frac[order[1]] < frac[order[2]]) std::swap(order[1], order[2]);
+    if (frac[order[0]] < frac[order[1]]) std::swap(order[0], order[1]);
+}
+
+} // namespace
+
+void ColorLUT3D::bake(int size, const Transform& transform) {
+    size_ = std::max(2, std::min(size, 256));
+    title_.clear();
+    domain_min_ = cv::Vec3f(0.0f, 0.0f, 0.0f);
+    domain_max_ = cv::Vec3f(1.0f, 1.0f, 1.0f);
+    lattice_.resize(static_cast<size_t>(size_) * size_ * size_);
+
+    const float step = 1.0f / (size_ - 1);
+    parallelFor(cv::Range(0, size_), [&](const cv::Range& range) {
+        for (int b = range.start; b < range.end; ++b) {
+            for (int g = 0; g < size_; ++g) {
+                cv::Vec3f* node = &lattice_[(static_cast<size_t>(b) * size_ + g) * size_];
+                for (int r = 0; r < size_; ++r) {
+                    node[r] = transform(cv::Vec3f(b * step, g * step, r * step));
+                }
+            }
+        }
+    });
+
+    buildFixedPoint();
+}
+
+bool ColorLUT3D::loadCube(const std::string& filename) {
+    std::ifstream file(filename);
+    if (!file.is_open()) {
+        return false;
+    }
+
+    int size = 0;
+    std::string title;
+    cv::Vec3f domain_min(0.0f, 0.0f, 0.0f);
+    cv::Vec3f domain_max(1.0f, 1.0f, 1.0f);
+    std::vector<cv::Vec3f> lattice;
+
+    std::string line;
+    while (std::getline(file, line)) {
+        size_t start = line.find_first_not_of(" \t\r");
+        if (start == std::string::npos || line[start] == '#') {
+            continue;
+        }
+
+        std::istringstream in(line.substr(start));
+        if (std::isalpha(static_cast<unsigned char>(line[start]))) {
+            std::string keyword;
+            in >> keyword;
+            float r, g, b;
+            if (keyword == "TITLE") {
+                size_t open = line.find('"');
+                size_t close = line.rfind('"');
+                if (open != std::string::npos && close > open) {
+                    title = line.substr(open + 1, close - open - 1);
+                }
+            } else if (keyword == "LUT_3D_SIZE") {
+                in >> size;
+            } else if (keyword == "DOMAIN_MIN" && (in >> r >> g >> b)) {
+                domain_min = cv::Vec3f(b, g, r);
+            } else if (keyword == "DOMAIN_MAX" && (in >> r >> g >> b)) {
+                domain_max = cv::Vec3f(b, g, r);
+            } else if (keyword == "LUT_3D_INPUT_RANGE" && (in >> r >> g)) {
+                domain_min = cv::Vec3f(r, r, r);
+                domain_max = cv::Vec3f(g, g, g);
+            } else if (keyword == "LUT_1D_SIZE") {
+                return false;
+            }
+            continue;
+        }
+
+        // Data lines are "R G B"
+        float r, g, b;
+        if (!(in >> r >> g >> b)) {
+            return false;
+        }
+        lattice.emplace_back(b, g, r);
+    }
+
+    if (size < 2 || size > 256 ||
+        lattice.size() != static_cast<size_t>(size) * size * size) {
+        return false;
+    }
+    for (int c = 0; c < 3; ++c) {
+        if (domain_max[c] <= domain_min[c]) {
+            return false;
+        }
+    }
+
+    size_ = size;
+    title_ = title;
+    domain_min_ = domain_min;
+    domain_max_ = domain_max;
+    lattice_.swap(lattice);
+    buildFixedPoint();
+    return true;
+}
+
+cv::Vec3f ColorLUT3D::lookup(const cv::Vec3f& bgr) const {
+    if (empty()) {
+        return bgr;
+    }
+
+    const size_t stride[3] = { static_cast<size_t>(size_) * size_,
+                               static_cast<size_t>(size_), 1 };
+    size_t base = 0;
+    float frac[3];
+    for (int c = 0; c < 3; ++c) {
+        float t = (bgr[c] - domain_min_[c]) / (domain_max_[c] - domain_min_[c]);
+        t = std::min(std::max(t, 0.0f), 1.0f) * (size_ - 1);
+        int i = std::min(static_cast<int>(t), size_ - 2);
+        frac[c] = t - i;
+        base += i * stride[c];
+    }
+
+    int order[3];
+    sortAxes(frac, order);
+    size_t i1 = base + stride[order[0]];
+    size_t i2 = i1 + stride[order[1]];
+    size_t i3 = i2 + stride[order[2]];
+
+    return lattice_[base] * (1.0f - frac[order[0]]) +
+           lattice_[i1] * (frac[order[0]] - frac[order[1]]) +
+           lattice_[i2] * (frac[order[1]] - frac[order[2]]) +
+           lattice_[i3] * frac[order[2]];
+}
+
+void ColorLUT3D::buildFixedPoint() {
+    fixed_.resize(lattice_.size() * 3);
+    for (size_t i = 0; i < lattice_.size(); ++i) {
+        for (int c = 0; c < 3; ++c) {
+            float v = std::min(std::max(lattice_[i][c], 0.0f), 1.0f);
+            fixed_[i * 3 + c] = static_cast<uint16_t>(cvRound(v * 255.0f * 128.0f));
+        }
+    }
+
+    for (int c = 0; c < 3; ++c) {
+        const float span = domain_max_[c] - domain_min_[c];
+        for (int v = 0; v < 256; ++v) {
+            float t = (v / 255.0f - domain_min_[c]) / span;
+            t = std::min(std::max(t, 0.0f), 1.0f) * (size_ - 1);
+            int i = std::min(static_cast<int>(t), size_ - 2);
+            index_[c][v] = i;
+            weight_[c][v] = cvRound((t - i) * 256.0f);
+        }
+    }
+}
+
+void ColorLUT3D::apply(const cv::Mat& src, cv::Mat& dst) const {
+    CV_Assert(src.type() == CV_8UC3);
+    if (empty()) {
+        if (dst.data != src.data) {
+            src.copyTo(dst);
+        }
+        return;
+    }
+    dst.create(src.size(), CV_8UC3);
+
+    // Strides in uint16 units: three per node
+    const int stride[3] = { size_ * size_ * 3, size_ * 3, 3 };
+    const uint16_t* lattice = fixed_.data();
+
+    parallelFor(cv::Range(0, src.rows), [&](const cv::Range& range) {
+        for (int y = range.start; y < range.end; ++y) {
+            const uchar* in = src.ptr<uchar>(y);
+            uchar* out = dst.ptr<uchar>(y);
+            for (int x = 0; x < src.cols * 3; x += 3) {
+                int base = 0;
+                int frac[3];
+                for (int c = 0; c < 3; ++c) {
+                    base += index_[c][in[x + c]] * stride[c];
+                    frac[c] = weight_[c][in[x + c]];
+                }
+
+                int order[3];
+                sortAxes(frac, order);
+                const uint16_t* n0 = lattice + base;
+                const uint16_t* n1 = n0 + stride[order[0]];
+                const uint16_t* n2 = n1 + stride[order[1]];
+                const uint16_t* n3 = n2 + stride[order[2]];
+                const int w0 = 256 - frac[order[0]];
+                const int w1 = frac[order[0]] - frac[order[1]];
+                const int w2 = frac[order[1]] - frac[order[2]];
+                const int w3 = frac[order[2]];
+
+                // Q7 entries times Q8 weights
+                for (int c = 0; c < 3; ++c) {
+                    out[x + c] = static_cast<uchar>(
+                        (n0[c] * w0 + n1[c] * w1 + n2[c] * w2 + n3[c] * w3 + (1 << 14)) >> 15);
+                }
+            }
+        }
+    });
+}
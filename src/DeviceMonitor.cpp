@@ -0,0 +1,320 @@
+#include "DeviceMonitor.h"
+#include <opencv2/core.hpp>
+#include <algorithm>
+#include <cstdio>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+// "videoN" -> N, anything else -> -1
+int videoNodeId(const char* name) {
+    int id = -1;
+    char tail = 0;
+    if (sscanf(name, "video%d%c", &id, &tail) == 1 && id >= 0) {
+        return id;
+    }
+    return -1;
+}
+
+} // namespace
+
+DeviceMonitor::DeviceMonitor(QObject* parent) 
+    : QThread(parent) {
+    qRegisterMetaType<CameraCapture::CameraInfo>();
+#ifndef _WIN32
+    stop_event_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+#endif
+}
+
+DeviceMonitor::~DeviceMonitor() {
+    stop();
+#ifndef _WIN32
+    if (stop_event_fd_ >= 0) {
+        close(stop_event_fd_);
+    }
+#endif
+}
+
+void DeviceMonitor::stop() {
+    stop_requested_ = true;
+#ifndef _WIN32
+    if (stop_event_fd_ >= 0) {
+        uint64_t one = 1;
+        ssize_t written = write(stop_event_fd_, &one, sizeof(one));
+        (void)written;
+    }
+#endif
+    wait();
+}
+
+std::vector<CameraCapture::CameraInfo> DeviceMonitor::cameras() const {
+    QMutexLocker lock(&mutex_);
+    std::vector<CameraCapture::CameraInfo> result;
+    for (const auto& entry : present_) {
+        result.push_back(entry.second);
+    }
+    return result;
+}
+
+std::string DeviceMonitor::cacheKey(const CameraCapture::CameraInfo& info) {
+    return info.driver + "|" + info.name + "|" + info.bus_info + "|" + 
+           std::to_string(info.driver_version);
+}
+
+bool DeviceMonitor::probeCached(int camera_id, CameraCapture::CameraInfo& info) {
+    if (!CameraCapture::probeCamera(camera_id, info, false)) {
+        return false;
+    }
+    
+    // The identity is not unique without a bus (e.g. the OpenCV fallback)
+    std::string key = info.bus_info.empty() ? std::string() : cacheKey(info);
+    {
+        QMutexLocker lock(&mutex_);
+        auto it = key.empty() ? cache_.end() : cache_.find(key);
+        if (it != cache_.end()) {
+            std::string device_path = info.device_path;
+            info = it->second;
+            info.id = camera_id;
+            info.device_path = device_path;
+            return true;
+        }
+    }
+    
+    if (!CameraCapture::probeCamera(camera_id, info, true)) {
+        return false;
+    }
+    
+    if (!key.empty()) {
+        QMutexLocker lock(&mutex_);
+        cache_[key] = info;
+    }
+    return true;
+}
+
+void DeviceMonitor::deviceAppeared(int camera_id) {
+    {
+        QMutexLocker lock(&mutex_);
+        if (present_.count(camera_id)) {
+            return;
+        }
+    }
+    
+    // Fails until udev has set permissions; retried on the IN_ATTRIB event
+    CameraCapture::CameraInfo info;
+    if (!probeCached(camera_id, info)) {
+        return;
+    }
+    
+    {
+        QMutexLocker lock(&mutex_);
+        present_[camera_id] = info;
+    }
+    emit cameraAdded(info);
+}
+
+void DeviceMonitor::deviceDisappeared(int camera_id) {
+    {
+        QMutexLocker lock(&mutex_);
+        if (present_.erase(camera_id) == 0) {
+            return;
+        }
+    }
+    emit cameraRemoved(camera_id);
+}
+
+void DeviceMonitor::scanDevices() {
+    // Identity probes first; only unknown cameras get the full probe
+    std::vector<CameraCapture::CameraInfo> found = 
+        CameraCapture::listAvailableCameras(false);
+    
+    std::vector<int> removed;
+    {
+        QMutexLocker lock(&mutex_);
+        for (const auto& entry : present_) {
+            bool still_there = false;
+            for (const auto& info : found) {
+                still_there |= info.id == entry.first;
+            }
+            if (!still_there) {
+                removed.push_back(entry.first);
+            }
+        }
+    }
+    
+    for (int id : removed) {
+        deviceDisappeared(id);
+    }
+    for (const auto& info : found) {
+        deviceAppeared(info.id);
+    }
+}
+
+void DeviceMonitor::run() {
+    stop_requested_ = false;
+    
+#ifndef _WIN32
+    int inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd >= 0 &&
+        inotify_add_watch(inotify_fd, "/dev", IN_CREATE | IN_DELETE | IN_ATTRIB) < 0) {
+        close(inotify_fd);
+        inotify_fd = -1;
+    }
+    
+    // Watch first, then scan, so nothing plugged in between is missed
+    scanDevices();
+    
+    alignas(inotify_event) char buffer[4096];
+    while (!stop_requested_) {
+        pollfd fds[2];
+        fds[0].fd = stop_event_fd_;
+        fds[0].events = POLLIN;
+        fds[1].fd = inotify_fd;
+        fds[1].events = POLLIN;
+        
+        // Without inotify, fall back to a slow rescan
+        int ready = poll(fds, inotify_fd >= 0 ? 2 : 1, inotify_fd >= 0 ? -1 : 5000);
+        if (stop_requested_ || (ready > 0 && (fds[0].revents & POLLIN))) {
+            break;
+        }
+        if (ready == 0) {
+            scanDevices();
+            continue;
+        }
+        if (ready < 0 || !(fds[1].revents & POLLIN)) {
+            continue;
+        }
+        
+        ssize_t length = read(inotify_fd, buffer, sizeof(buffer));
+        for (ssize_t offset = 0; offset < length; ) {
+            const inotify_event* event = 
+                reinterpret_cast<const inotify_event*>(buffer + offset);
+            offset += sizeof(inotify_event) + event->len;
+            
+            int id = event->len > 0 ? videoNodeId(event->name) : -1;
+            if (id < 0) {
+                continue;
+            }
+            
+            if (event->mask & IN_DELETE) {
+                deviceDisappeared(id);
+            } else {
+                deviceAppeared(id);
+            }
+        }
+    }
+    
+    if (inotify_fd >= 0) {
+        close(inotify_fd);
+    }
+#else
+    while (!stop_requested_) {
+        scanDevices();
+        for (int i = 0; i < 50 && !stop_requested_; ++i) {
+            msleep(100);
+        }
+    }
+#endif
+}
+
+bool DeviceMonitor::loadCache(const std::string& filename) {
+    cv::FileStorage fs(filename, cv::FileStorage::READ);
+    if (!fs.isOpened()) {
+        return false;
+    }
+    
+    std::map<std::string, CameraCapture::CameraInfo> cache;
+    for (const auto& camera_node : fs["cameras"]) {
+        CameraCapture::CameraInfo info;
+        info.id = -1;
+        camera_node["name"] >> info.name;
+        camera_node["driver"] >> info.driver;
+        camera_node["bus_info"] >> info.bus_info;
+        int version = 0;
+        camera_node["driver_version"] >> version;
+        info.driver_version = static_cast<uint32_t>(version);
+        
+        for (const auto& format_node : camera_node["formats"]) {
+            CameraCapture::FormatInfo fmt;
+            int fourcc = 0;
+            int format = 0;
+            int pattern = 0;
+            int compressed = 0;
+            format_node["fourcc"] >> fourcc;
+            format_node["format"] >> format;
+            format_node["bayer_pattern"] >> pattern;
+            format_node["description"] >> fmt.description;
+            format_node["compressed"] >> compressed;
+            fmt.fourcc = static_cast<uint32_t>(fourcc);
+            fmt.format = static_cast<CameraCapture::PixelFormat>(format);
+            fmt.bayer_pattern = static_cast<CameraCapture::BayerPattern>(pattern);
+            fmt.compressed = compressed != 0;
+            
+            for (const auto& size_node : format_node["sizes"]) {
+                CameraCapture::FrameSizeInfo size;
+                size_node["width"] >> size.width;
+                size_node["height"] >> size.height;
+                size_node["frame_rates"] >> size.frame_rates;
+                fmt.sizes.push_back(size);
+            }
+            info.formats.push_back(fmt);
+        }
+        
+        info.updateResolutions();
+        
+        cache[cacheKey(info)] = info;
+    }
+    
+    QMutexLocker lock(&mutex_);
+    for (auto& entry : cache) {
+        cache_.insert(entry);
+    }
+    return true;
+}
+
+bool DeviceMonitor::saveCache(const std::string& filename) const {
+    cv::FileStorage fs(filename, cv::FileStorage::WRITE);
+    if (!fs.isOpened()) {
+        return false;
+    }
+    
+    QMutexLocker lock(&mutex_);
+    fs << "cameras" << "[";
+    for (const auto& entry : cache_) {
+        const CameraCapture::CameraInfo& info = entry.second;
+        fs << "{";
+        fs << "name" << info.name;
+        fs << "driver" << info.driver;
+        fs << "bus_info" << info.bus_info;
+        fs << "driver_version" << static_cast<int>(info.driver_version);
+        fs << "formats" << "[";
+        for (const auto& fmt : info.formats) {
+            fs << "{";
+            fs << "fourcc" << static_cast<int>(fmt.fourcc);
+            fs << "format" << static_cast<int>(fmt.format);
+            fs << "bayer_pattern" << static_cast<int>(fmt.bayer_pattern);
+            fs << "description" << fmt.description;
+            fs << "compressed" << static_cast<int>(fmt.compressed);
+            fs << "sizes" << "[";
+            for (const auto& size : fmt.sizes) {
+                fs << "{";
+                fs << "width" << size.width;
+                fs << "height" << size.height;
+                fs << "frame_rates" << size.frame_rates;
+                fs << "}";
+            }
+            fs << "]";
+            fs << "}";
+        }
+        fs << "]";
+        fs << "}";
+    }
+    fs << "]";
+    
+    return true;
+}
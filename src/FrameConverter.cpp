@@ -0,0 +1,257 @@
+#include "FrameConverter.h"
+#include "ParallelFor.h"
+#include <opencv2/imgproc.hpp>
+#include <opencv2/imgcodecs.hpp>
+
+#ifdef HAVE_TURBOJPEG
+#include <turbojpeg.h>
+#endif
+
+// SSSE3 unpack kernels are compiled in on x86 regardless of -march and
+// selected at runtime; other targets use the scalar loops.
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <tmmintrin.h>
+#define RAW_UNPACK_SSSE3 1
+#define RAW_UNPACK_TARGET __attribute__((target("ssse3")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <tmmintrin.h>
+#define RAW_UNPACK_SSSE3 1
+#define RAW_UNPACK_TARGET
+#endif
+
+namespace {
+
+// RAW10P: bytes 0-3 hold bits 9:2 of four samples, byte 4 their bits 1:0
+void unpackRaw10RowScalar(const uchar* src, ushort* dst, int x, int width) {
+    for (; x + 4 <= width; x += 4) {
+        const uchar* group = src + (x / 4) * 5;
+        const uchar lsb = group[4];
+        dst[x]     = static_cast<ushort>((group[0] << 2) | (lsb & 3));
+        dst[x + 1] = static_cast<ushort>((group[1] << 2) | ((lsb >> 2) & 3));
+        dst[x + 2] = static_cast<ushort>((group[2] << 2) | ((lsb >> 4) & 3));
+        dst[x + 3] = static_cast<ushort>((group[3] << 2) | (lsb >> 6));
+    }
+}
+
+// RAW12P: bytes 0-1 hold bits 11:4 of two samples, byte 2 their bits 3:0
+void unpackRaw12RowScalar(const uchar* src, ushort* dst, int x, int width) {
+    for (; x + 2 <= width; x += 2) {
+        const uchar* pair = src + (x / 2) * 3;
+        dst[x]     = static_cast<ushort>((pair[0] << 4) | (pair[2] & 0x0F));
+        dst[x + 1] = static_cast<ushort>((pair[1] << 4) | (pair[2] >> 4));
+    }
+}
+
+#ifdef RAW_UNPACK_SSSE3
+// Eight samples (two 5-byte groups) per iteration. Returns the first
+// sample left for the scalar tail.
+RAW_UNPACK_TARGET int unpackRaw10RowSSSE3(const uchar* src, ushort* dst, 
+                                          int width, int src_bytes) {
+    const __m128i msb_shuffle = _mm_setr_epi8(0, -1, 1, -1, 2, -1, 3, -1,
+                                              5, -1, 6, -1, 7, -1, 8, -1);
+    const __m128i lsb_shuffle = _mm_setr_epi8(4, -1, 4, -1, 4, -1, 4, -1,
+                                              9, -1, 9, -1, 9, -1, 9, -1);
+    // Shift each sample's 2-bit field up to bits 7:6 so one >>6 isolates it
+    const __m128i lsb_scale = _mm_setr_epi16(64, 16, 4, 1, 64, 16, 4, 1);
+    const __m128i mask2 = _mm_set1_epi16(3);
+    
+    int x = 0;
+    // The 16-byte load reads 6 bytes past the 10 consumed
+    for (; x + 8 <= width && (x / 4) * 5 + 16 <= src_bytes; x += 8) {
+        __m128i packed = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(src + (x / 4) * 5));
+        __m128i msb = _mm_shuffle_epi8(packed, msb_shuffle);
+        __m128i lsb = _mm_shuffle_epi8(packed, lsb_shuffle);
+        lsb = _mm_and_si128(_mm_srli_epi16(_mm_mullo_epi16(lsb, lsb_scale), 6), mask2);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x),
+                         _mm_or_si128(_mm_slli_epi16(msb, 2), lsb));
+    }
+    return x;
+}
+
+// Eight samples (four 3-byte pairs) per iteration
+RAW_UNPACK_TARGET int unpackRaw12RowSSSE3(const uchar* src, ushort* dst, 
+                                          int width, int src_bytes) {
+    const __m128i msb_shuffle = _mm_setr_epi8(0, -1, 1, -1, 3, -1, 4, -1,
+                                              6, -1, 7, -1, 9, -1, 10, -1);
+    const __m128i lsb_shuffle = _mm_setr_epi8(2, -1, 2, -1, 5, -1, 5, -1,
+                                              8, -1, 8, -1, 11, -1, 11, -1);
+    // Even samples take the low nibble, odd samples the high one
+    const __m128i lsb_scale = _mm_setr_epi16(16, 1, 16, 1, 16, 1, 16, 1);
+    const __m128i mask4 = _mm_set1_epi16(0x0F);
+    
+    int x = 0;
+    for (; x + 8 <= width && (x / 2) * 3 + 16 <= src_bytes; x += 8) {
+        __m128i packed = _mm_loadu_si128(
+            reinterpret_cast<const __m128i*>(src + (x / 2) * 3));
+        __m128i msb = _mm_shuffle_epi8(packed, msb_shuffle);
+        __m128i lsb = _mm_shuffle_epi8(packed, lsb_shuffle);
+        lsb = _mm_and_si128(_mm_srli_epi16(_mm_mullo_epi16(lsb, lsb_scale), 4), mask4);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x),
+                         _mm_or_si128(_mm_slli_epi16(msb, 4), lsb));
+    }
+    return x;
+}
+#endif
+
+} // namespace
+
+FrameConverter::FrameConverter() {
+#ifdef HAVE_TURBOJPEG
+    tj_handle_ = tjInitDecompress();
+#endif
+}
+
+FrameConverter::~FrameConverter() {
+#ifdef HAVE_TURBOJPEG
+    if (tj_handle_) {
+        tjDestroy(static_cast<tjhandle>(tj_handle_));
+        tj_handle_ = nullptr;
+    }
+#endif
+}
+
+bool FrameConverter::toBGR(const cv::Mat& src, CameraCapture::PixelFormat format, 
+                           cv::Mat& bgr) {
+    if (src.empty()) {
+        return false;
+    }
+    
+    // OpenCV's YUV kernels are vectorized and row-parallel; dst is created
+    // in place so a reused buffer is never reallocated.
+    switch (format) {
+        case CameraCapture::FORMAT_BGR24:
+            src.copyTo(bgr);
+            return true;
+            
+        case CameraCapture::FORMAT_RGB24:
+            cv::cvtColor(src, bgr, cv::COLOR_RGB2BGR);
+            return true;
+            
+        case CameraCapture::FORMAT_YUYV:
+            if (src.type() != CV_8UC2) return false;
+            cv::cvtColor(src, bgr, cv::COLOR_YUV2BGR_YUYV);
+            return true;
+            
+        case CameraCapture::FORMAT_NV12:
+            if (src.type() != CV_8UC1 || src.rows % 3 != 0) return false;
+            cv::cvtColor(src, bgr, cv::COLOR_YUV2BGR_NV12);
+            return true;
+            
+        case CameraCapture::FORMAT_MJPEG:
+            return decodeMJPEG(src, bgr);
+            
+        default:
+            return false;
+    }
+}
+
+bool FrameConverter::decodeMJPEG(const cv::Mat& jpeg, cv::Mat& bgr) {
+    const size_t size = jpeg.total() * jpeg.elemSize();
+    
+#ifdef HAVE_TURBOJPEG
+    if (tj_handle_ && jpeg.isContinuous()) {
+        tjhandle handle = static_cast<tjhandle>(tj_handle_);
+        const unsigned char* data = jpeg.ptr<unsigned char>();
+        
+        int width = 0, height = 0, subsamp = 0, colorspace = 0;
+        if (tjDecompressHeader3(handle, data, static_cast<unsigned long>(size),
+                                &width, &height, &subsamp, &colorspace) == 0) {
+            bgr.create(height, width, CV_8UC3);
+            
+            if (tjDecompress2(handle, data, static_cast<unsigned long>(size),
+                              bgr.ptr<unsigned char>(), width, 
+                              static_cast<int>(bgr.step), height,
+                              TJPF_BGR, TJFLAG_FASTDCT) == 0) {
+                return true;
+            }
+        }
+        // Corrupt or truncated frames fall through to OpenCV below
+    }
+#endif
+    
+    cv::imdecode(jpeg.reshape(1, 1), cv::IMREAD_COLOR, &bgr);
+    return !bgr.empty() && size > 0;
+}
+
+bool FrameConverter::unpackRaw10(const cv::Mat& packed, cv::Mat& bayer16) {
+    if (packed.empty() || packed.type() != CV_8UC1) {
+        return false;
+    }
+    
+    const int width = packed.cols * 4 / 5;
+    bayer16.create(packed.rows, width, CV_16UC1);
+    
+#ifdef RAW_UNPACK_SSSE3
+    static const bool use_ssse3 = cv::checkHardwareSupport(CV_CPU_SSSE3);
+#endif
+    
+    parallelFor(cv::Range(0, packed.rows), [&](const cv::Range& range) {
+        for (int y = range.start; y < range.end; ++y) {
+            const uchar* src = packed.ptr<uchar>(y);
+            ushort* dst = bayer16.ptr<ushort>(y);
+            int x = 0;
+#ifdef RAW_UNPACK_SSSE3
+            if (use_ssse3) {
+                x = unpackRaw10RowSSSE3(src, dst, width, packed.cols);
+            }
+#endif
+            unpackRaw10RowScalar(src, dst, x, width);
+        }
+    });
+    
+    return true;
+}
+
+bool FrameConverter::unpackRaw12(const cv::Mat& packed, cv::Mat& bayer16) {
+    if (packed.empty() || packed.type() != CV_8UC1) {
+        return false;
+    }
+    
+    const int width = packed.cols * 2 / 3;
+    bayer16.create(packed.rows, width, CV_16UC1);
+    
+#ifdef RAW_UNPACK_SSSE3
+    static const bool use_ssse3 = cv::checkHardwareSupport(CV_CPU_SSSE3);
+#endif
+    
+    parallelFor(cv::Range(0, packed.rows), [&](const cv::Range& range) {
+        for (int y = range.start; y < range.end; ++y) {
+            const uchar* src = packed.ptr<uchar>(y);
+            ushort* dst = bayer16.ptr<ushort>(y);
+            int x = 0;
+#ifdef RAW_UNPACK_SSSE3
+            if (use_ssse3) {
+                x = unpackRaw12RowSSSE3(src, dst, width, packed.cols);
+            }
+#endif
+            unpackRaw12RowScalar(src, dst, x, width);
+        }
+    });
+    
+    return true;
+}
+
+bool FrameConverter::demosaicPreview(const cv::Mat& bayer, CameraCapture::BayerPattern pattern,
+                                     int bit_depth, cv::Mat& bgr) {
+    if (bayer.empty()) {
+        return false;
+    }
+    
+    // OpenCV names Bayer codes after the second row, so V4L2 BGGR is its RG
+    int code = cv::COLOR_BayerRG2BGR;
+    switch (pattern) {
+        case CameraCapture::BAYER_BGGR: code = cv::COLOR_BayerRG2BGR; break;
+        case CameraCapture::BAYER_GBRG: code = cv::COLOR_BayerGR2BGR; break;
+        case CameraCapture::BAYER_GRBG: code = cv::COLOR_BayerGB2BGR; break;
+        case CameraCapture::BAYER_RGGB: code = cv::COLOR_BayerBG2BGR; break;
+    }
+    
+    if (bayer.depth() == CV_8U) {
+        cv::cvtColor(bayer, bgr, code);
+    } else {
+        bayer.convertTo(bayer8_, CV_8U, 255.0 / ((1 << bit_depth) - 1));
+        cv::cvtColor(bayer8_, bgr, code);
+    }
+    return true;
+}
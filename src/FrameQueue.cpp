@@ -0,0 +1,98 @@
+#include "FrameQueue.h"
+#include <algorithm>
+
+void FrameQueue::configure(CameraCapture::DeliveryPolicy policy, size_t capacity, 
+                           size_t lease_budget) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    policy_ = policy;
+    capacity_ = policy == CameraCapture::DELIVER_LATEST ? 1 : std::max<size_t>(capacity, 1);
+    lease_budget_ = lease_budget;
+    max_depth_ = 0;
+}
+
+size_t FrameQueue::push(const CameraCapture::FrameLease& lease) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    size_t dropped = 0;
+    
+    if (policy_ == CameraCapture::DELIVER_LATEST) {
+        // Stale frames go back to the driver immediately
+        dropped = frames_.size();
+        frames_.clear();
+        leased_ = 0;
+    } else {
+        not_full_.wait(lock, [this]() { return frames_.size() < capacity_ || closed_; });
+    }
+    
+    if (closed_) {
+        return dropped;
+    }
+    
+    frames_.push_back(lease);
+    if (lease.pinsDriverBuffer()) {
+        if (leased_ < lease_budget_) {
+            leased_++;
+        } else {
+            frames_.back().detach();
+        }
+    }
+    
+    max_depth_ = std::max(max_depth_, frames_.size());
+    not_empty_.notify_one();
+    
+    return dropped;
+}
+
+bool FrameQueue::pop(CameraCapture::FrameLease& lease) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [this]() { return !frames_.empty() || closed_; });
+    
+    if (closed_) {
+        return false;
+    }
+    
+    lease = std::move(frames_.front());
+    frames_.pop_front();
+    if (lease.pinsDriverBuffer() && leased_ > 0) {
+        leased_--;
+    }
+    
+    not_full_.notify_one();
+    return true;
+}
+
+void FrameQueue::close() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = true;
+    frames_.clear();
+    leased_ = 0;
+    not_empty_.notify_all();
+    not_full_.notify_all();
+}
+
+void FrameQueue::reopen() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    closed_ = false;
+    max_depth_ = 0;
+}
+
+void FrameQueue::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    frames_.clear();
+    leased_ = 0;
+    not_full_.notify_all();
+}
+
+size_t FrameQueue::depth() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return frames_.size();
+}
+
+size_t FrameQueue::capacity() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return capacity_;
+}
+
+size_t FrameQueue::maxDepth() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return max_depth_;
+}
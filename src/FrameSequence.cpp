@@ -0,0 +1,167 @@
+#include "FrameSequence.h"
+#include <cstring>
+
+namespace {
+
+const char kMagic[8] = {'C', 'A', 'M', 'S', 'E', 'Q', '0', '1'};
+
+// The format is little-endian; so are all the platforms we build for
+template <typename T>
+void writeValue(std::ofstream& file, T value) {
+    file.write(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+template <typename T>
+bool readValue(std::ifstream& file, T& value) {
+    return static_cast<bool>(file.read(reinterpret_cast<char*>(&value), sizeof(T)));
+}
+
+bool isRecordedType(int type) {
+    switch (type) {
+        case CV_8UC1:
+        case CV_8UC2:
+        case CV_8UC3:
+        case CV_16UC1:
+        case CV_16UC3:
+            return true;
+        default:
+            return false;
+    }
+}
+
+} // namespace
+
+bool FrameSequenceWriter::open(const std::string& filename, int width, int height,
+                               CameraCapture::PixelFormat format,
+                               CameraCapture::BayerPattern pattern, int fps) {
+    close();
+    file_.open(filename, std::ios::binary | std::ios::trunc);
+    if (!file_.is_open()) {
+        return false;
+    }
+    
+    file_.write(kMagic, sizeof(kMagic));
+    writeValue<uint32_t>(file_, static_cast<uint32_t>(width));
+    writeValue<uint32_t>(file_, static_cast<uint32_t>(height));
+    writeValue<uint32_t>(file_, static_cast<uint32_t>(format));
+    writeValue<uint32_t>(file_, static_cast<uint32_t>(pattern));
+    writeValue<uint32_t>(file_, static_cast<uint32_t>(fps));
+    
+    return static_cast<bool>(file_);
+}
+
+bool FrameSequenceWriter::write(const cv::Mat& frame, 
+                                const CameraCapture::FrameMetadata& metadata) {
+    if (!file_.is_open() || frame.empty() || !isRecordedType(frame.type())) {
+        return false;
+    }
+    
+    writeValue<int64_t>(file_, metadata.timestamp_ns);
+    writeValue<uint64_t>(file_, metadata.sequence);
+    writeValue<uint32_t>(file_, static_cast<uint32_t>(frame.rows));
+    writeValue<uint32_t>(file_, static_cast<uint32_t>(frame.cols));
+    writeValue<uint32_t>(file_, static_cast<uint32_t>(frame.type()));
+    
+    // Row by row, so padded driver buffers are written without the padding
+    const size_t row_bytes = frame.cols * frame.elemSize();
+    for (int y = 0; y < frame.rows; ++y) {
+        file_.write(reinterpret_cast<const char*>(frame.ptr(y)), row_bytes);
+    }
+    
+    return static_cast<bool>(file_);
+}
+
+void FrameSequenceWriter::close() {
+    if (file_.is_open()) {
+        file_.close();
+    }
+}
+
+bool FrameSequenceReader::isSequenceFile(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary);
+    char magic[sizeof(kMagic)] = {};
+    return file.read(magic, sizeof(magic)) && memcmp(magic, kMagic, sizeof(kMagic)) == 0;
+}
+
+bool FrameSequenceReader::open(const std::string& filename) {
+    close();
+    file_.open(filename, std::ios::binary);
+    if (!file_.is_open()) {
+        return false;
+    }
+    
+    char magic[sizeof(kMagic)] = {};
+    uint32_t width = 0, height = 0, format = 0, pattern = 0, fps = 0;
+    if (!file_.read(magic, sizeof(magic)) || memcmp(magic, kMagic, sizeof(kMagic)) != 0 ||
+        !readValue(file_, width) || !readValue(file_, height) ||
+        !readValue(file_, format) || !readValue(file_, pattern) || !readValue(file_, fps)) {
+        close();
+        return false;
+    }
+    
+    width_ = static_cast<int>(width);
+    height_ = static_cast<int>(height);
+    format_ = static_cast<CameraCapture::PixelFormat>(format);
+    pattern_ = static_cast<CameraCapture::BayerPattern>(pattern);
+    fps_ = static_cast<int>(fps);
+    first_frame_ = file_.tellg();
+    file_.seekg(0, std::ios::end);
+    file_size_ = file_.tellg();
+    file_.seekg(first_frame_);
+    
+    return true;
+}
+
+bool FrameSequenceReader::read(cv::Mat& frame, CameraCapture::FrameMetadata& metadata) {
+    if (!file_.is_open()) {
+        return false;
+    }
+    
+    int64_t timestamp_ns = 0;
+    uint64_t sequence = 0;
+    uint32_t rows = 0, cols = 0, type = 0;
+    if (!readValue(file_, timestamp_ns) || !readValue(file_, sequence) ||
+        !readValue(file_, rows) || !readValue(file_, cols) || !readValue(file_, type)) {
+        return false;
+    }
+    
+    // Guard against truncated or corrupt headers before allocating: the
+    // type must be one the writer emits and its pixels must be in the file
+    if (rows == 0 || cols == 0 || rows > 65536 || cols > (1u << 26) ||
+        !isRecordedType(static_cast<int>(type))) {
+        return false;
+    }
+    const size_t row_bytes = static_cast<size_t>(cols) * CV_ELEM_SIZE(type);
+    const std::streamoff remaining = file_size_ - static_cast<std::streamoff>(file_.tellg());
+    if (static_cast<uint64_t>(rows) * row_bytes > static_cast<uint64_t>(remaining)) {
+        return false;
+    }
+    
+    frame.create(static_cast<int>(rows), static_cast<int>(cols), static_cast<int>(type));
+    for (int y = 0; y < frame.rows; ++y) {
+        if (!file_.read(reinterpret_cast<char*>(frame.ptr(y)), row_bytes)) {
+            return false;
+        }
+    }
+    
+    metadata.timestamp_ns = timestamp_ns;
+    metadata.sequence = sequence;
+    metadata.pixel_format = format_;
+    metadata.bayer_pattern = pattern_;
+    
+    return true;
+}
+
+void FrameSequenceReader::rewind() {
+    if (file_.is_open()) {
+        file_.clear();
+        file_.seekg(first_frame_);
+    }
+}
+
+void FrameSequenceReader::close() {
+    if (file_.is_open()) {
+        file_.close();
+    }
+    file_.clear();
+}
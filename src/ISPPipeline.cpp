@@ -1,152 +1,638 @@
 #include "ISPPipeline.h"
+#include "ColorLUT3D.h"
+#include "ParallelFor.h"
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
 #include <cmath>
 #include <fstream>
+#include <mutex>
 #include <opencv2/opencv.hpp>
+#include <opencv2/core/hal/intrin.hpp>
 
-ISPPipeline::ISPPipeline() {
-    generateGammaLUT();
+namespace {
+
+// OpenCV's default allocator, counting the buffers it allocates. Blocks
+// record the default allocator as their owner and are freed through it.
+class CountingMatAllocator : public cv::MatAllocator {
+public:
+    explicit CountingMatAllocator(std::atomic<uint64_t>& count) : count_(count) {}
+    
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+                           cv::AccessFlag flags, cv::UMatUsageFlags usage) const override {
+        if (!data) {
+            count_++;
+        }
+        return cv::Mat::getDefaultAllocator()->allocate(dims, sizes, type, data, step, 
+                                                        flags, usage);
+    }
+    
+    bool allocate(cv::UMatData* data, cv::AccessFlag flags, 
+                  cv::UMatUsageFlags usage) const override {
+        return cv::Mat::getDefaultAllocator()->allocate(data, flags, usage);
+    }
+    
+    void deallocate(cv::UMatData* data) const override {
+        cv::Mat::getDefaultAllocator()->deallocate(data);
+    }
+    
+private:
+    std::atomic<uint64_t>& count_;
+};
+
+// A copy that shares no Mat data with params, so neither the caller nor a
+// published snapshot can change the other's tables
+ISPPipeline::ISPParameters detachedCopy(const ISPPipeline::ISPParameters& params) {
+    ISPPipeline::ISPParameters copy = params;
+    copy.camera_matrix = params.camera_matrix.clone();
+    copy.distortion_coeffs = params.distortion_coeffs.clone();
+    return copy;
+}
+
+// Exponent of the gamma curve; a gamma that is not positive leaves levels alone
+float gammaInverse(float gamma) {
+    return gamma > 0.0f ? 1.0f / gamma : 1.0f;
+}
+
+} // namespace
+
+ISPPipeline::ISPPipeline()
+    : buffer_allocator_(new CountingMatAllocator(buffer_allocations_)),
+      published_params_(std::make_shared<const ParameterSnapshot>()) {
+    // Version 1, ahead of params_version_, so the first frame builds the tables
+    updateParameters([](ISPParameters&) {});
     clahe_ = cv::createCLAHE();
     clahe_->setClipLimit(2.0);
+    
+    for (cv::Mat* buffer : { &demosaic_buffer_, &demosaic_wide_, &mosaic_8bit_, &color_lut_ }) {
+        buffer->allocator = buffer_allocator_.get();
+    }
+    useCountingAllocator(frame_buffers_);
+    demosaic_.setAllocator(buffer_allocator_.get());
 }
 
 ISPPipeline::~ISPPipeline() {}
 
 void ISPPipeline::processRaw(const cv::Mat& raw_bayer, cv::Mat& output_rgb) {
+    std::shared_ptr<const ParameterSnapshot> snapshot = std::atomic_load(&published_params_);
+    processRaw(raw_bayer, output_rgb, snapshot->params.bayer_pattern, 
+               snapshot->params.raw_bit_depth);
+}
+
+void ISPPipeline::processRaw(const cv::Mat& raw_bayer, cv::Mat& output_rgb,
+                             BayerPattern pattern, int bit_depth) {
     if (raw_bayer.empty()) return;
     
-    cv::Mat rgb;
-    demosaicBayer(raw_bayer, rgb);
-    processRGB(rgb, output_rgb);
+    refreshParameters();
+    const uint64_t allocations = buffer_allocations_.load();
+    demosaicBayer(raw_bayer, demosaic_buffer_, pattern, bit_depth);
+    processFrame(demosaic_buffer_, output_rgb);
+    frame_buffer_allocations_ = buffer_allocations_.load() - allocations;
+}
+
+void ISPPipeline::useCountingAllocator(StageBuffers& buffers) {
+    buffers.image.allocator = buffer_allocator_.get();
+    buffers.scratch.allocator = buffer_allocator_.get();
+    buffers.spatial.setAllocator(buffer_allocator_.get());
+    buffers.sharpen.setAllocator(buffer_allocator_.get());
+}
+
+// The caller's Mat cannot carry our allocator, which it may outlive, so its
+// reallocations are counted here
+void ISPPipeline::reserveOutput(cv::Mat& output, cv::Size size, int type) {
+    if (output.size() != size || output.type() != type) {
+        output.create(size, type);
+        buffer_allocations_++;
+    }
 }
 
 void ISPPipeline::processRGB(const cv::Mat& input_rgb, cv::Mat& output_rgb) {
+    refreshParameters();
+    demosaic_gains_ = {{ 1.0f, 1.0f, 1.0f }};
+    processFrame(input_rgb, output_rgb);
+}
+
+void ISPPipeline::processFrame(const cv::Mat& input_rgb, cv::Mat& output_rgb) {
     if (input_rgb.empty()) {
         output_rgb = cv::Mat();
         return;
     }
     
-    cv::Mat processed = input_rgb.clone();
+    const uint64_t allocations = buffer_allocations_.load();
+    
+    // Stages write into the output, so an input sharing its memory is
+    // read from a copy
+    const cv::Mat* input = &input_rgb;
+    if (input_rgb.datastart == output_rgb.datastart) {
+        input_rgb.copyTo(frame_buffers_.image);
+        input = &frame_buffers_.image;
+    }
+    
+    // The staged colour path normalizes over the whole frame, so it cannot
+    // be split into tiles; 16-bit frames always take the fused one
+    const bool wide = params_.high_bit_depth && input_rgb.type() == CV_16UC3;
+    const bool tileable_color = wide || (input_rgb.type() == CV_8UC3 &&
+        params_.color_path != ISPParameters::ColorPath::STAGED);
+    if (params_.tiled_execution && tileable_color) {
+        processTiled(*input, output_rgb);
+        frame_buffer_allocations_ = buffer_allocations_.load() - allocations;
+        return;
+    }
+    tile_timings_.clear();
+    
+    // Every stage from here runs in place on the output
+    cv::Mat& processed = output_rgb;
+    reserveOutput(processed, input->size(), input->type());
+    
+    // Colour statistics come from the input before lens correction, as
+    // they do in tiled mode
+    if (tileable_color) {
+        prepareColor(*input);
+    }
     
-    if (params_.lens_correction && !params_.camera_matrix.empty() && 
-        !params_.distortion_coeffs.empty()) {
-        applyLensCorrection(processed);
+    if (lensCorrectionEnabled()) {
+        applyLensCorrection(*input, processed);
+        input = &processed;
     }
     
-    applyWhiteBalance(processed);
-    applyColorCorrection(processed);
-    applyGamma(processed);
-    applyToneMapping(processed);
+    if (tileable_color) {
+        applyColor(*input, processed);
+    } else {
+        if (input != &processed) {
+            input->copyTo(processed);
+        }
+        applyWhiteBalance(processed);
+        applyColorCorrection(processed);
+        applyGamma(processed);
+        applyToneMapping(processed);
+    }
     
     if (params_.denoise_enabled) {
-        applyDenoising(processed);
+        beginDenoising(processed);
+        applyDenoising(processed, frame_buffers_, 0, 0, processed.rows);
+        endDenoising();
+    } else {
+        beginDenoising(cv::Mat());
     }
     
     if (params_.sharpen_enabled) {
-        applySharpening(processed);
+        applySharpening(processed, frame_buffers_);
     }
     
-    output_rgb = processed;
+    frame_buffer_allocations_ = buffer_allocations_.load() - allocations;
+}
+
+bool ISPPipeline::lensCorrectionEnabled() const {
+    return params_.lens_correction && !params_.camera_matrix.empty() && 
+           !params_.distortion_coeffs.empty();
+}
+
+void ISPPipeline::updateLensMaps(cv::Size size) {
+    if (lens_maps_version_ == params_version_ && lens_maps_size_ == size) {
+        return;
+    }
+    // Focal lengths and principal point follow the frame's scale; the
+    // distortion coefficients act on normalized coordinates and do not
+    cv::Mat camera_matrix = params_.camera_matrix;
+    const cv::Size& calibrated = params_.lens_calibration_size;
+    if (!calibrated.empty() && calibrated != size) {
+        // A new Mat: the snapshot's must not change
+        cv::Mat scaled;
+        params_.camera_matrix.convertTo(scaled, CV_64F);
+        const double sx = static_cast<double>(size.width) / calibrated.width;
+        const double sy = static_cast<double>(size.height) / calibrated.height;
+        scaled.at<double>(0, 0) *= sx;
+        scaled.at<double>(0, 1) *= sx;
+        scaled.at<double>(0, 2) = (scaled.at<double>(0, 2) + 0.5) * sx - 0.5;
+        scaled.at<double>(1, 1) *= sy;
+        scaled.at<double>(1, 2) = (scaled.at<double>(1, 2) + 0.5) * sy - 0.5;
+        camera_matrix = scaled;
+    }
+    undistort_maps_.update(camera_matrix, params_.distortion_coeffs,
+                           size, params_.undistort_alpha);
+    lens_maps_version_ = params_version_;
+    lens_maps_size_ = size;
 }
 
-void ISPPipeline::demosaicBayer(const cv::Mat& bayer, cv::Mat& rgb) {
-    if (bayer.type() == CV_8UC1) {
-        switch (params_.demosaic_method) {
-            case BILINEAR:
-                cv::cvtColor(bayer, rgb, cv::COLOR_BayerBG2BGR);
+// Rows that a tile must process beyond its own so that its neighbourhood
+// stages see the same input as on the whole frame
+int ISPPipeline::tileHalo() const {
+    int halo = 0;
+    if (params_.denoise_enabled) {
+        switch (params_.denoise_mode) {
+            case ISPParameters::DenoiseMode::TEMPORAL:
+                halo += params_.denoise_prefilter ? 1 : 0;  // 3x3 prefilter
+                break;
+            case ISPParameters::DenoiseMode::NLM:
+                halo += 7 / 2 + 21 / 2;     // template and search radius
+                if (params_.high_bit_depth) {
+                    // 16-bit frames fall through to the guided filter
+                    halo = std::max(halo, SpatialDenoiser::guidedFilterHalo(params_.denoise_radius));
+                }
                 break;
-            case VNG:
-                cv::cvtColor(bayer, rgb, cv::COLOR_BayerBG2BGR_VNG);
+            case ISPParameters::DenoiseMode::GUIDED:
+                halo += SpatialDenoiser::guidedFilterHalo(params_.denoise_radius);
                 break;
-            case AHD:
-                cv::cvtColor(bayer, rgb, cv::COLOR_BayerBG2BGR_EA);
+            case ISPParameters::DenoiseMode::BILATERAL_GRID:
+                halo += SpatialDenoiser::bilateralGridHalo(bilateralGridCell());
                 break;
         }
-    } else {
-        bayer.convertTo(rgb, CV_8UC3);
     }
+    if (params_.sharpen_enabled) {
+        halo += UnsharpMask::halo(params_.sharpen_radius);
+    }
+    return halo;
 }
 
-void ISPPipeline::applyWhiteBalance(cv::Mat& rgb) {
-    if (params_.auto_wb) {
-        // Simple gray world assumption
-        cv::Scalar mean = cv::mean(rgb);
-        float avg = (mean[0] + mean[1] + mean[2]) / 3.0f;
+// Horizontal strips of tile_height rows, each run through the whole chain
+// on one worker while it is in cache. Every stage of a strip treats the
+// extended strip as the frame; the halo is at least the sum of the stage
+// radii, so the rows written back match whole-frame processing.
+// Frame-wide colour statistics (gray world, the FUSED stretch) are taken
+// from the input, before lens correction.
+void ISPPipeline::processTiled(const cv::Mat& input_rgb, cv::Mat& output_rgb) {
+    const bool lens = lensCorrectionEnabled();
+    if (lens) {
+        updateLensMaps(input_rgb.size());
+    }
+    prepareColor(input_rgb);
+    beginDenoising(params_.denoise_enabled ? input_rgb : cv::Mat());
+    
+    const int rows = input_rgb.rows;
+    const int tile_rows = std::max(8, params_.tile_height);
+    const int tiles = (rows + tile_rows - 1) / tile_rows;
+    const int halo = tileHalo();
+    
+    reserveOutput(output_rgb, input_rgb.size(), input_rgb.type());
+    tile_timings_.assign(tiles, TileTiming());
+    while (static_cast<int>(tile_buffers_.size()) < tiles) {
+        tile_buffers_.emplace_back();
+        useCountingAllocator(tile_buffers_.back());
+    }
+    
+    const double ms_per_tick = 1000.0 / cv::getTickFrequency();
+    parallelFor(cv::Range(0, tiles), [&](const cv::Range& range) {
+        for (int t = range.start; t < range.end; ++t) {
+            const int y0 = t * tile_rows;
+            const int y1 = std::min(rows, y0 + tile_rows);
+            const int top = std::max(0, y0 - halo);
+            const int bottom = std::min(rows, y1 + halo);
+            StageBuffers& buffers = tile_buffers_[t];
+            cv::Mat& strip = buffers.image;
+            
+            int64_t start = cv::getTickCount();
+            if (lens) {
+                undistort_maps_.remapRows(input_rgb, strip, top, bottom);
+            } else {
+                input_rgb.rowRange(top, bottom).copyTo(strip);
+            }
+            int64_t lens_done = cv::getTickCount();
+            
+            applyColor(strip, strip);
+            int64_t color_done = cv::getTickCount();
+            
+            if (params_.denoise_enabled) {
+                applyDenoising(strip, buffers, top, y0 - top, y1 - top);
+            }
+            int64_t denoise_done = cv::getTickCount();
+            
+            if (params_.sharpen_enabled) {
+                applySharpening(strip, buffers);
+            }
+            int64_t sharpen_done = cv::getTickCount();
+            
+            strip.rowRange(y0 - top, y1 - top).copyTo(output_rgb.rowRange(y0, y1));
+            
+            TileTiming& timing = tile_timings_[t];
+            timing.row_begin = y0;
+            timing.rows = y1 - y0;
+            timing.halo_rows = (y0 - top) + (bottom - y1);
+            timing.lens_ms = (lens_done - start) * ms_per_tick;
+            timing.color_ms = (color_done - lens_done) * ms_per_tick;
+            timing.denoise_ms = (denoise_done - color_done) * ms_per_tick;
+            timing.sharpen_ms = (sharpen_done - denoise_done) * ms_per_tick;
+            timing.total_ms = (cv::getTickCount() - start) * ms_per_tick;
+        }
+    });
+    
+    endDenoising();
+}
+
+void ISPPipeline::demosaicBayer(const cv::Mat& bayer, cv::Mat& rgb,
+                                BayerPattern pattern, int bit_depth) {
+    demosaic_gains_ = {{ 1.0f, 1.0f, 1.0f }};
+    if (bayer.channels() != 1) {
+        bayer.convertTo(rgb, CV_8UC3);
+        return;
+    }
+    
+    // The in-house kernels balance with the gains the frame would get
+    // now: the stream's current auto estimate, or the manual gains
+    if (params_.demosaic_method == ISPParameters::DemosaicMethod::BILINEAR ||
+        params_.demosaic_method == ISPParameters::DemosaicMethod::MALVAR_HE_CUTLER) {
+        if (params_.auto_wb) {
+            AutoWhiteBalance::Gains gains = white_balance_[stream_].gains();
+            demosaic_gains_ = {{ gains.blue, gains.green, gains.red }};
+        } else {
+            demosaic_gains_ = {{ params_.wb_blue, params_.wb_green, params_.wb_red }};
+        }
+        // Kept positive so the colour stages can divide them back out
+        for (float& gain : demosaic_gains_) {
+            gain = std::max(gain, 1.0f / 256.0f);
+        }
         
-        if (mean[0] > 0) params_.wb_blue = avg / mean[0];
-        if (mean[1] > 0) params_.wb_green = avg / mean[1];
-        if (mean[2] > 0) params_.wb_red = avg / mean[2];
+        BayerDemosaic::Settings settings;
+        settings.pattern = pattern;
+        settings.method = params_.demosaic_method == ISPParameters::DemosaicMethod::BILINEAR
+                        ? BayerDemosaic::BILINEAR : BayerDemosaic::MALVAR_HE_CUTLER;
+        settings.bit_depth = bit_depth;
+        settings.black_level = params_.black_level;
+        settings.output_depth = params_.high_bit_depth ? CV_16U : CV_8U;
+        settings.gain_blue = demosaic_gains_[0];
+        settings.gain_green = demosaic_gains_[1];
+        settings.gain_red = demosaic_gains_[2];
+        demosaic_.process(bayer, rgb, settings);
+        return;
+    }
+    
+    // OpenCV names its Bayer codes after the second row: RGGB is "BG"
+    int vng = cv::COLOR_BayerBG2BGR_VNG;
+    int edge_aware = cv::COLOR_BayerBG2BGR_EA;
+    switch (pattern) {
+        case BayerPattern::BGGR:
+            vng = cv::COLOR_BayerRG2BGR_VNG;
+            edge_aware = cv::COLOR_BayerRG2BGR_EA;
+            break;
+        case BayerPattern::GBRG:
+            vng = cv::COLOR_BayerGR2BGR_VNG;
+            edge_aware = cv::COLOR_BayerGR2BGR_EA;
+            break;
+        case BayerPattern::GRBG:
+            vng = cv::COLOR_BayerGB2BGR_VNG;
+            edge_aware = cv::COLOR_BayerGB2BGR_EA;
+            break;
+        case BayerPattern::RGGB:
+            break;
     }
     
-    std::vector<cv::Mat> channels;
-    cv::split(rgb, channels);
+    // Black level and range come off in the conversion to the working depth
+    const bool wide = params_.high_bit_depth;
+    const int input_max = bayer.depth() == CV_8U ? 255 : (1 << std::max(bit_depth, 8)) - 1;
+    const int black = std::min(std::max(params_.black_level, 0), input_max - 1);
+    const double alpha = (wide ? 65535.0 : 255.0) / (input_max - black);
+    const double beta = -black * alpha;
     
-    channels[0] *= params_.wb_blue;
-    channels[1] *= params_.wb_green;
-    channels[2] *= params_.wb_red;
+    // VNG is 8-bit only, so a 16-bit pipeline demosaics edge-aware;
+    // edge-aware runs at sensor depth
+    const bool use_vng = !wide && params_.demosaic_method == ISPParameters::DemosaicMethod::VNG;
+    cv::Mat mosaic = bayer;
+    bool leveled = false;
+    if (mosaic.depth() != CV_8U && use_vng) {
+        mosaic.convertTo(mosaic_8bit_, CV_8U, alpha, beta);
+        mosaic = mosaic_8bit_;
+        leveled = true;
+    }
+    
+    // Demosaics at another depth than the output go to their own buffer,
+    // so neither buffer changes type from frame to frame
+    const int depth = wide ? CV_16U : CV_8U;
+    cv::Mat& demosaiced = mosaic.depth() == depth ? rgb : demosaic_wide_;
+    cv::cvtColor(mosaic, demosaiced, use_vng ? vng : edge_aware);
     
-    cv::merge(channels, rgb);
+    if (&demosaiced != &rgb || (!leveled && (black > 0 || alpha != 1.0))) {
+        demosaiced.convertTo(rgb, depth, alpha, beta);
+    }
+}
+
+// Sets the gains this frame is balanced with: the auto white balance
+// estimate for the selected stream, or the manual ones, less what the
+// demosaic already applied. The estimate is kept apart from params_,
+// which belong to the caller.
+void ISPPipeline::updateWhiteBalance(const cv::Mat& frame) {
+    AutoWhiteBalance& awb = white_balance_[stream_];
+    std::array<float, 3> target;
+    if (params_.auto_wb) {
+        AutoWhiteBalance::Gains applied;
+        applied.blue = demosaic_gains_[0];
+        applied.green = demosaic_gains_[1];
+        applied.red = demosaic_gains_[2];
+        awb.setSettings(params_.awb_settings);
+        awb.update(frame, applied);
+        AutoWhiteBalance::Gains gains = awb.gains();
+        target = {{ gains.blue, gains.green, gains.red }};
+    } else {
+        awb.reset();
+        target = {{ params_.wb_blue, params_.wb_green, params_.wb_red }};
+    }
+    
+    for (int c = 0; c < 3; ++c) {
+        wb_gains_[c] = target[c] / demosaic_gains_[c];
+    }
+}
+
+AutoWhiteBalance::Gains ISPPipeline::getAutoWhiteBalanceGains(int stream) const {
+    return white_balance_[std::min(std::max(stream, 0), kMaxStreams - 1)].gains();
+}
+
+void ISPPipeline::applyWhiteBalance(cv::Mat& rgb) {
+    updateWhiteBalance(rgb);
+    
+    cv::multiply(rgb, cv::Scalar(wb_gains_[0], wb_gains_[1], wb_gains_[2]), rgb);
     cv::normalize(rgb, rgb, 0, 255, cv::NORM_MINMAX);
     rgb.convertTo(rgb, CV_8UC3);
 }
 
-void ISPPipeline::applyColorCorrection(cv::Mat& rgb) {
-    if (params_.color_matrix.val[0] != 1.0f || 
-        params_.color_matrix.val[4] != 1.0f || 
-        params_.color_matrix.val[8] != 1.0f) {
+namespace {
+
+// The colour matrix in Q12, for 8-bit data; false if a coefficient does not
+// fit in int16 (|m| >= 8), in which case callers use the float kernel
+bool colorMatrixQ12(const cv::Matx33f& m, short q[9]) {
+    for (int i = 0; i < 9; ++i) {
+        float scaled = m.val[i] * 4096.0f;
+        if (!(std::abs(scaled) < 32767.0f)) {
+            return false;
+        }
+        q[i] = static_cast<short>(cvRound(scaled));
+    }
+    return true;
+}
+
+// out_k = (q_k0 * b + q_k1 * g + q_k2 * r + 0.5) >> 12, on interleaved BGR;
+// src and dst may alias
+void colorMatrixRow8u(const uchar* src, uchar* dst, int width, const short q[9]) {
+    int x = 0;
+#if CV_SIMD
+    // Pixels are paired as (b, g) and (r, 1) int16 lanes, so each output is
+    // two dot products; the constant lane carries the rounding term
+    const int lanes = cv::v_uint8::nlanes;
+    const cv::v_int16 one = cv::vx_setall_s16(1);
+    cv::v_int16 coef_bg[3];
+    cv::v_int16 coef_r1[3];
+    for (int k = 0; k < 3; ++k) {
+        coef_bg[k] = cv::v_reinterpret_as_s16(cv::vx_setall_s32(
+            static_cast<ushort>(q[k * 3]) | (static_cast<int>(q[k * 3 + 1]) << 16)));
+        coef_r1[k] = cv::v_reinterpret_as_s16(cv::vx_setall_s32(
+            static_cast<ushort>(q[k * 3 + 2]) | (2048 << 16)));
+    }
+    
+    for (; x <= width - lanes; x += lanes) {
+        cv::v_uint8 b, g, r;
+        cv::v_load_deinterleave(src + x * 3, b, g, r);
         
-        cv::Mat float_rgb;
-        rgb.convertTo(float_rgb, CV_32FC3);
+        cv::v_uint16 b16[2], g16[2], r16[2];
+        cv::v_expand(b, b16[0], b16[1]);
+        cv::v_expand(g, g16[0], g16[1]);
+        cv::v_expand(r, r16[0], r16[1]);
         
-        std::vector<cv::Mat> channels;
-        cv::split(float_rgb, channels);
+        cv::v_uint8 out[3];
+        for (int k = 0; k < 3; ++k) {
+            cv::v_int16 half[2];
+            for (int h = 0; h < 2; ++h) {
+                cv::v_int16 bg0, bg1, r0, r1;
+                cv::v_zip(cv::v_reinterpret_as_s16(b16[h]), cv::v_reinterpret_as_s16(g16[h]), bg0, bg1);
+                cv::v_zip(cv::v_reinterpret_as_s16(r16[h]), one, r0, r1);
+                cv::v_int32 s0 = cv::v_dotprod(bg0, coef_bg[k]) + cv::v_dotprod(r0, coef_r1[k]);
+                cv::v_int32 s1 = cv::v_dotprod(bg1, coef_bg[k]) + cv::v_dotprod(r1, coef_r1[k]);
+                half[h] = cv::v_pack(cv::v_shr<12>(s0), cv::v_shr<12>(s1));
+            }
+            out[k] = cv::v_pack_u(half[0], half[1]);
+        }
+        cv::v_store_interleave(dst + x * 3, out[0], out[1], out[2]);
+    }
+#endif
+    for (; x < width; ++x) {
+        const int b = src[x * 3];
+        const int g = src[x * 3 + 1];
+        const int r = src[x * 3 + 2];
+        for (int k = 0; k < 3; ++k) {
+            dst[x * 3 + k] = cv::saturate_cast<uchar>(
+                (q[k * 3] * b + q[k * 3 + 1] * g + q[k * 3 + 2] * r + 2048) >> 12);
+        }
+    }
+}
+
+// Float kernel for 8-bit data whose matrix does not fit Q12
+void colorMatrixRow8uFloat(const uchar* src, uchar* dst, int width, const cv::Matx33f& m) {
+    for (int x = 0; x < width * 3; x += 3) {
+        const float b = src[x];
+        const float g = src[x + 1];
+        const float r = src[x + 2];
+        dst[x]     = cv::saturate_cast<uchar>(m.val[0] * b + m.val[1] * g + m.val[2] * r);
+        dst[x + 1] = cv::saturate_cast<uchar>(m.val[3] * b + m.val[4] * g + m.val[5] * r);
+        dst[x + 2] = cv::saturate_cast<uchar>(m.val[6] * b + m.val[7] * g + m.val[8] * r);
+    }
+}
+
+// 16-bit data needs more headroom than Q12 in int32 leaves, so it runs in float
+void colorMatrixRow16u(const ushort* src, ushort* dst, int width, const cv::Matx33f& m) {
+    int x = 0;
+#if CV_SIMD
+    const int lanes = cv::v_uint16::nlanes;
+    cv::v_float32 coef[9];
+    for (int i = 0; i < 9; ++i) {
+        coef[i] = cv::vx_setall_f32(m.val[i]);
+    }
+    
+    for (; x <= width - lanes; x += lanes) {
+        cv::v_uint16 b, g, r;
+        cv::v_load_deinterleave(src + x * 3, b, g, r);
         
-        cv::Mat corrected = cv::Mat::zeros(float_rgb.size(), CV_32FC3);
+        cv::v_uint32 b32[2], g32[2], r32[2];
+        cv::v_expand(b, b32[0], b32[1]);
+        cv::v_expand(g, g32[0], g32[1]);
+        cv::v_expand(r, r32[0], r32[1]);
         
-        for (int i = 0; i < float_rgb.rows; ++i) {
-            for (int j = 0; j < float_rgb.cols; ++j) {
-                cv::Vec3f pixel(
-                    channels[0].at<float>(i, j),
-                    channels[1].at<float>(i, j),
-                    channels[2].at<float>(i, j)
-                );
-                
-                cv::Vec3f corrected_pixel = params_.color_matrix * pixel;
-                
-                corrected.at<cv::Vec3f>(i, j) = corrected_pixel;
+        cv::v_uint16 out[3];
+        for (int k = 0; k < 3; ++k) {
+            cv::v_int32 half[2];
+            for (int h = 0; h < 2; ++h) {
+                cv::v_float32 fb = cv::v_cvt_f32(cv::v_reinterpret_as_s32(b32[h]));
+                cv::v_float32 fg = cv::v_cvt_f32(cv::v_reinterpret_as_s32(g32[h]));
+                cv::v_float32 fr = cv::v_cvt_f32(cv::v_reinterpret_as_s32(r32[h]));
+                cv::v_float32 sum = fb * coef[k * 3];
+                sum = cv::v_muladd(fg, coef[k * 3 + 1], sum);
+                sum = cv::v_muladd(fr, coef[k * 3 + 2], sum);
+                half[h] = cv::v_round(sum);
             }
+            out[k] = cv::v_pack_u(half[0], half[1]);
+        }
+        cv::v_store_interleave(dst + x * 3, out[0], out[1], out[2]);
+    }
+#endif
+    for (; x < width; ++x) {
+        const float b = src[x * 3];
+        const float g = src[x * 3 + 1];
+        const float r = src[x * 3 + 2];
+        for (int k = 0; k < 3; ++k) {
+            dst[x * 3 + k] = cv::saturate_cast<ushort>(
+                m.val[k * 3] * b + m.val[k * 3 + 1] * g + m.val[k * 3 + 2] * r);
         }
-        
-        corrected.convertTo(rgb, CV_8UC3);
     }
 }
 
-void ISPPipeline::generateGammaLUT() {
-    params_.gamma_lut = cv::Mat(1, 256, CV_8UC1);
-    uchar* lut = params_.gamma_lut.ptr();
+// Interleaved CV_8UC3 or CV_16UC3, row-parallel, in place when dst is src
+void applyColorMatrix(const cv::Mat& src, cv::Mat& dst, const cv::Matx33f& m) {
+    CV_Assert(src.type() == CV_8UC3 || src.type() == CV_16UC3);
+    dst.create(src.size(), src.type());
     
-    float gamma_inv = 1.0f / params_.gamma;
+    short q[9];
+    const bool fixed_point = src.depth() == CV_8U && colorMatrixQ12(m, q);
+    
+    parallelFor(cv::Range(0, src.rows), [&](const cv::Range& range) {
+        for (int y = range.start; y < range.end; ++y) {
+            if (src.depth() == CV_16U) {
+                colorMatrixRow16u(src.ptr<ushort>(y), dst.ptr<ushort>(y), src.cols, m);
+            } else if (fixed_point) {
+                colorMatrixRow8u(src.ptr<uchar>(y), dst.ptr<uchar>(y), src.cols, q);
+            } else {
+                colorMatrixRow8uFloat(src.ptr<uchar>(y), dst.ptr<uchar>(y), src.cols, m);
+            }
+        }
+    });
+}
+
+} // namespace
+
+void ISPPipeline::applyColorCorrection(cv::Mat& rgb) {
+    if (params_.color_matrix == cv::Matx33f::eye()) {
+        return;
+    }
     
-    for (int i = 0; i < 256; ++i) {
-        lut[i] = cv::saturate_cast<uchar>(
-            pow(i / 255.0f, gamma_inv) * 255.0f
-        );
+    if (rgb.type() == CV_8UC3 || rgb.type() == CV_16UC3) {
+        applyColorMatrix(rgb, rgb, params_.color_matrix);
+        return;
     }
+    
+    cv::Mat float_rgb;
+    rgb.convertTo(float_rgb, CV_32FC3);
+    cv::transform(float_rgb, float_rgb, params_.color_matrix);
+    float_rgb.convertTo(rgb, CV_MAKETYPE(rgb.depth(), 3));
+}
+
+// The tables follow params_.gamma on their own; a new version just makes
+// the pipeline rebuild them
+void ISPPipeline::generateGammaLUT() {
+    updateParameters([](ISPParameters&) {});
 }
 
 void ISPPipeline::applyGamma(cv::Mat& rgb) {
-    if (!params_.gamma_lut.empty()) {
-        std::vector<cv::Mat> channels;
-        cv::split(rgb, channels);
-        
-        for (auto& channel : channels) {
-            cv::LUT(channel, params_.gamma_lut, channel);
-        }
-        
-        cv::merge(channels, rgb);
-    }
+    // A single-channel table applies to every channel
+    cv::LUT(rgb, cv::Mat(1, 256, CV_8U, gamma_lut_), rgb);
 }
 
 void ISPPipeline::applyToneMapping(cv::Mat& rgb) {
+    // 8-bit frames go through a table of the same arithmetic
+    if (rgb.depth() == CV_8U) {
+        uchar table[256];
+        for (int v = 0; v < 256; ++v) {
+            float f = v * (1.0f / 255.0f) * params_.exposure;
+            f = f * params_.contrast + params_.brightness;
+            table[v] = cv::saturate_cast<uchar>(std::min(std::max(f, 0.0f), 1.0f) * 255.0f);
+        }
+        cv::LUT(rgb, cv::Mat(1, 256, CV_8U, table), rgb);
+        return;
+    }
+    
     cv::Mat float_rgb;
     rgb.convertTo(float_rgb, CV_32FC3, 1.0/255.0);
     
@@ -164,30 +650,414 @@ void ISPPipeline::applyToneMapping(cv::Mat& rgb) {
     float_rgb.convertTo(rgb, CV_8UC3, 255.0);
 }
 
-void ISPPipeline::applyDenoising(cv::Mat& rgb) {
-    cv::Mat denoised;
-    cv::fastNlMeansDenoisingColored(rgb, denoised, 
-                                   params_.denoise_strength,
-                                   params_.denoise_strength * 0.5f,
-                                   7, 21);
-    rgb = denoised;
+namespace {
+
+// Per-channel min/max of an 8-bit BGR frame
+void channelRange(const cv::Mat& bgr, uchar lo[3], uchar hi[3]) {
+    for (int c = 0; c < 3; ++c) {
+        lo[c] = 255;
+        hi[c] = 0;
+    }
+    std::mutex merge_mutex;
+    parallelFor(cv::Range(0, bgr.rows), [&](const cv::Range& range) {
+        uchar l[3] = { 255, 255, 255 };
+        uchar h[3] = { 0, 0, 0 };
+        for (int y = range.start; y < range.end; ++y) {
+            const uchar* row = bgr.ptr<uchar>(y);
+            for (int x = 0; x < bgr.cols * 3; x += 3) {
+                for (int c = 0; c < 3; ++c) {
+                    l[c] = std::min(l[c], row[x + c]);
+                    h[c] = std::max(h[c], row[x + c]);
+                }
+            }
+        }
+        std::lock_guard<std::mutex> lock(merge_mutex);
+        for (int c = 0; c < 3; ++c) {
+            lo[c] = std::min(lo[c], l[c]);
+            hi[c] = std::max(hi[c], h[c]);
+        }
+    });
+}
+
+// The colour chain evaluated at full precision, for baking the 3D LUT
+cv::Vec3f bakedColor(const ISPPipeline::ISPParameters& p, const std::array<float, 3>& gains,
+                     const ColorLUT3D* grade, const cv::Vec3f& bgr) {
+    cv::Vec3f v;
+    for (int c = 0; c < 3; ++c) {
+        v[c] = std::min(bgr[c] * 255.0f * gains[c], 255.0f);
+    }
+    v = p.color_matrix * v;
+    
+    for (int c = 0; c < 3; ++c) {
+        float f = std::min(std::max(v[c], 0.0f), 255.0f) / 255.0f;
+        f = std::pow(f, gammaInverse(p.gamma));
+        f = f * p.exposure * p.contrast + p.brightness;
+        v[c] = std::min(std::max(f, 0.0f), 1.0f);
+    }
+    
+    return grade ? grade->lookup(v) : v;
+}
+
+} // namespace
+
+// Whole-frame work for the FUSED and LUT_3D colour paths: white balance,
+// the min/max stretch and the tables. applyColor() then touches each pixel
+// once and can run on any part of the frame, such as a tile.
+//
+// FUSED gives the same result as applyWhiteBalance, applyColorCorrection,
+// applyGamma and applyToneMapping in sequence. WB plus the stretch is a
+// per-channel table, gamma plus tone mapping a shared table after it;
+// without a CCM the two compose into one lookup per channel.
+//
+// 16-bit frames have no stretch, as the demosaic already mapped black and
+// white to the ends of the range; only the Q12 gains are per frame.
+void ISPPipeline::prepareColor(const cv::Mat& frame) {
+    updateWhiteBalance(frame);
+    
+    if (frame.depth() == CV_16U) {
+        // Below 16, so a gained 16-bit sample fits 32 bits
+        for (int c = 0; c < 3; ++c) {
+            wb_q12_[c] = static_cast<uint32_t>(cvRound(std::min(wb_gains_[c], 15.99f) * 4096.0f));
+        }
+        return;
+    }
+    
+    if (params_.color_path == ISPParameters::ColorPath::LUT_3D) {
+        updateColorLUT();
+        return;
+    }
+    
+    const std::array<float, 3>& gains = wb_gains_;
+    
+    // The staged path stretches the gained frame with normalize(NORM_MINMAX);
+    // the gains are monotonic, so its extremes follow from the input's
+    uchar lo[3], hi[3];
+    channelRange(frame, lo, hi);
+    int gained_min = 255;
+    int gained_max = 0;
+    for (int c = 0; c < 3; ++c) {
+        gained_min = std::min<int>(gained_min, cv::saturate_cast<uchar>(lo[c] * gains[c]));
+        gained_max = std::max<int>(gained_max, cv::saturate_cast<uchar>(hi[c] * gains[c]));
+    }
+    const double span = gained_max - gained_min;
+    const double scale = span > DBL_EPSILON ? 255.0 / span : 0.0;
+    const float stretch = static_cast<float>(scale);
+    const float offset = static_cast<float>(-gained_min * scale);
+    
+    for (int c = 0; c < 3; ++c) {
+        for (int v = 0; v < 256; ++v) {
+            uchar gained = cv::saturate_cast<uchar>(v * gains[c]);
+            wb_lut_[c][v] = cv::saturate_cast<uchar>(gained * stretch + offset);
+        }
+    }
+    
+    if (!ccm_enabled_) {
+        color_lut_.create(1, 256, CV_8UC3);
+        cv::Vec3b* lut = color_lut_.ptr<cv::Vec3b>();
+        for (int v = 0; v < 256; ++v) {
+            for (int c = 0; c < 3; ++c) {
+                lut[v][c] = tone_lut_[wb_lut_[c][v]];
+            }
+        }
+    }
 }
 
-void ISPPipeline::applySharpening(cv::Mat& rgb) {
-    cv::Mat blurred;
-    cv::GaussianBlur(rgb, blurred, cv::Size(0, 0), 3.0);
+// dst may be src; otherwise it must already have src's size and type
+void ISPPipeline::applyColor(const cv::Mat& src, cv::Mat& dst) const {
+    if (src.depth() == CV_16U) {
+        applyColor16(src, dst);
+        return;
+    }
     
-    cv::addWeighted(rgb, 1.0 + params_.sharpen_strength,
-                   blurred, -params_.sharpen_strength,
-                   0, rgb);
+    if (params_.color_path == ISPParameters::ColorPath::LUT_3D) {
+        color_lut_3d_->apply(src, dst);
+        return;
+    }
+    
+    // cv::LUT would do the same, through OpenCV's allocating thread pool
+    if (!ccm_enabled_) {
+        const cv::Vec3b* lut = color_lut_.ptr<cv::Vec3b>();
+        parallelFor(cv::Range(0, src.rows), [&](const cv::Range& range) {
+            for (int y = range.start; y < range.end; ++y) {
+                const uchar* in = src.ptr<uchar>(y);
+                uchar* row = dst.ptr<uchar>(y);
+                const int n = src.cols * 3;
+                for (int x = 0; x < n; x += 3) {
+                    row[x]     = lut[in[x]][0];
+                    row[x + 1] = lut[in[x + 1]][1];
+                    row[x + 2] = lut[in[x + 2]][2];
+                }
+            }
+        });
+        return;
+    }
+    
+    // Table, matrix and table per row, so the row stays in L1 between them
+    const cv::Matx33f& m = params_.color_matrix;
+    parallelFor(cv::Range(0, src.rows), [&](const cv::Range& range) {
+        for (int y = range.start; y < range.end; ++y) {
+            const uchar* in = src.ptr<uchar>(y);
+            uchar* row = dst.ptr<uchar>(y);
+            const int n = src.cols * 3;
+            for (int x = 0; x < n; x += 3) {
+                row[x]     = wb_lut_[0][in[x]];
+                row[x + 1] = wb_lut_[1][in[x + 1]];
+                row[x + 2] = wb_lut_[2][in[x + 2]];
+            }
+            if (ccm_fixed_point_) {
+                colorMatrixRow8u(row, row, src.cols, ccm_q12_);
+            } else {
+                colorMatrixRow8uFloat(row, row, src.cols, m);
+            }
+            for (int x = 0; x < n; ++x) {
+                row[x] = tone_lut_[row[x]];
+            }
+        }
+    });
 }
 
-void ISPPipeline::applyLensCorrection(cv::Mat& rgb) {
-    cv::Mat undistorted;
-    cv::undistort(rgb, undistorted, 
-                  params_.camera_matrix,
-                  params_.distortion_coeffs);
-    rgb = undistorted;
+// Gains, matrix and table per row, as on the 8-bit path; without a CCM the
+// gain and the table are one loop
+void ISPPipeline::applyColor16(const cv::Mat& src, cv::Mat& dst) const {
+    const ushort* tone = tone_lut16_.data();
+    const uint32_t gain[3] = { wb_q12_[0], wb_q12_[1], wb_q12_[2] };
+    auto gained = [&](ushort v, int c) {
+        return static_cast<ushort>(std::min<uint32_t>((v * gain[c] + 2048) >> 12, 65535));
+    };
+    
+    const cv::Matx33f& m = params_.color_matrix;
+    parallelFor(cv::Range(0, src.rows), [&](const cv::Range& range) {
+        for (int y = range.start; y < range.end; ++y) {
+            const ushort* in = src.ptr<ushort>(y);
+            ushort* row = dst.ptr<ushort>(y);
+            const int n = src.cols * 3;
+            if (!ccm_enabled_) {
+                for (int x = 0; x < n; x += 3) {
+                    row[x]     = tone[gained(in[x], 0)];
+                    row[x + 1] = tone[gained(in[x + 1], 1)];
+                    row[x + 2] = tone[gained(in[x + 2], 2)];
+                }
+                continue;
+            }
+            
+            for (int x = 0; x < n; x += 3) {
+                row[x]     = gained(in[x], 0);
+                row[x + 1] = gained(in[x + 1], 1);
+                row[x + 2] = gained(in[x + 2], 2);
+            }
+            colorMatrixRow16u(row, row, src.cols, m);
+            for (int x = 0; x < n; ++x) {
+                row[x] = tone[row[x]];
+            }
+        }
+    });
+}
+
+void ISPPipeline::updateColorLUT() {
+    if (lut_build_.valid() && 
+        lut_build_.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        color_lut_3d_ = lut_build_.get();
+    }
+    
+    const cv::Matx33f& m = params_.color_matrix;
+    ColorLUTKey key;
+    key.values = { wb_gains_[0], wb_gains_[1], wb_gains_[2],
+                   m.val[0], m.val[1], m.val[2], m.val[3], m.val[4], 
+                   m.val[5], m.val[6], m.val[7], m.val[8],
+                   params_.gamma,
+                   params_.exposure, params_.contrast, params_.brightness };
+    key.grade_generation = grade_generation_.load();
+    key.size = params_.lut_size;
+    
+    // One bake at a time; a change made meanwhile is picked up once it lands
+    if ((color_lut_3d_ && key == lut_key_) || lut_build_.valid()) {
+        return;
+    }
+    lut_key_ = key;
+    
+    auto bake = [params = params_, gains = wb_gains_, grade = std::atomic_load(&grade_lut_)]() {
+        auto lut = std::make_shared<ColorLUT3D>();
+        lut->bake(params.lut_size, [&](const cv::Vec3f& bgr) {
+            return bakedColor(params, gains, grade.get(), bgr);
+        });
+        return std::shared_ptr<const ColorLUT3D>(lut);
+    };
+    
+    // The first lattice is baked inline so there is always one to apply
+    if (!color_lut_3d_) {
+        color_lut_3d_ = bake();
+    } else {
+        lut_build_ = std::async(std::launch::async, bake);
+    }
+}
+
+bool ISPPipeline::loadColorLUT(const std::string& filename) {
+    auto grade = std::make_shared<ColorLUT3D>();
+    if (!grade->loadCube(filename)) {
+        return false;
+    }
+    
+    std::atomic_store(&grade_lut_, std::shared_ptr<const ColorLUT3D>(grade));
+    grade_generation_++;
+    return true;
+}
+
+void ISPPipeline::clearColorLUT() {
+    std::atomic_store(&grade_lut_, std::shared_ptr<const ColorLUT3D>());
+    grade_generation_++;
+}
+
+// Starts a frame for the temporal filter of the selected stream, or drops
+// its history when this frame is not temporally denoised (an empty frame)
+void ISPPipeline::beginDenoising(const cv::Mat& frame) {
+    while (stream_ >= static_cast<int>(temporal_denoisers_.size())) {
+        temporal_denoisers_.emplace_back();
+        temporal_denoisers_.back().setAllocator(buffer_allocator_.get());
+    }
+    TemporalDenoiser& denoiser = temporal_denoisers_[stream_];
+    
+    if ((frame.type() != CV_8UC3 && frame.type() != CV_16UC3) || frame.empty() ||
+        params_.denoise_mode != ISPParameters::DenoiseMode::TEMPORAL) {
+        denoiser.reset();
+        active_denoiser_ = nullptr;
+        return;
+    }
+    
+    TemporalDenoiser::Settings settings;
+    settings.strength = params_.denoise_strength;
+    settings.spatial_prefilter = params_.denoise_prefilter;
+    denoiser.beginFrame(frame.size(), settings);
+    active_denoiser_ = &denoiser;
+}
+
+// frame_row and the update range locate a tile in the frame: the temporal
+// filter keeps state for the rows a tile owns, the bilateral grid anchors
+// its cells to frame rows
+void ISPPipeline::applyDenoising(cv::Mat& rgb, StageBuffers& buffers, int frame_row, 
+                                 int update_begin, int update_end) {
+    switch (params_.denoise_mode) {
+        case ISPParameters::DenoiseMode::TEMPORAL:
+            if (active_denoiser_) {
+                active_denoiser_->filterRows(rgb, frame_row, update_begin, update_end,
+                                             buffers.scratch);
+            }
+            break;
+        case ISPParameters::DenoiseMode::NLM:
+            if (rgb.depth() == CV_8U) {
+                cv::fastNlMeansDenoisingColored(rgb, buffers.scratch, 
+                                               params_.denoise_strength,
+                                               params_.denoise_strength * 0.5f,
+                                               7, 21);
+                buffers.scratch.copyTo(rgb);
+                break;
+            }
+            // fastNlMeans is 8-bit only
+            [[fallthrough]];
+        case ISPParameters::DenoiseMode::GUIDED: {
+            // eps as the square of a strength-scaled noise level
+            const float level = 8.0f * params_.denoise_strength;
+            buffers.spatial.guidedFilter(rgb, rgb, std::max(params_.denoise_radius, 1),
+                                         level * level);
+            break;
+        }
+        case ISPParameters::DenoiseMode::BILATERAL_GRID:
+            buffers.spatial.bilateralGrid(rgb, rgb, bilateralGridCell(),
+                                          cvRound(8.0f + 8.0f * params_.denoise_strength),
+                                          frame_row);
+            break;
+    }
+}
+
+// Spatial cell size of the bilateral grid, from the denoise radius
+int ISPPipeline::bilateralGridCell() const {
+    return 2 * std::max(params_.denoise_radius, 1) + 2;
+}
+
+void ISPPipeline::endDenoising() {
+    if (active_denoiser_) {
+        active_denoiser_->endFrame();
+        active_denoiser_ = nullptr;
+    }
+}
+
+void ISPPipeline::applySharpening(cv::Mat& rgb, StageBuffers& buffers) {
+    UnsharpMask::Settings settings;
+    settings.radius = params_.sharpen_radius;
+    settings.amount = params_.sharpen_strength;
+    settings.threshold = params_.sharpen_threshold;
+    buffers.sharpen.apply(rgb, settings);
+}
+
+void ISPPipeline::applyLensCorrection(const cv::Mat& src, cv::Mat& dst) {
+    updateLensMaps(src.size());
+    undistort_maps_.remapRows(src, dst, 0, src.rows);
+}
+
+void ISPPipeline::setParameters(const ISPParameters& params) {
+    updateParameters([&](ISPParameters& published) { published = params; });
+}
+
+ISPPipeline::ISPParameters ISPPipeline::getParameters() const {
+    return detachedCopy(std::atomic_load(&published_params_)->params);
+}
+
+uint64_t ISPPipeline::getParametersVersion() const {
+    return std::atomic_load(&published_params_)->version;
+}
+
+// Copies the latest snapshot, applies the change and publishes the result.
+// Writers serialize on the mutex; the processing thread never takes it.
+void ISPPipeline::updateParameters(const std::function<void(ISPParameters&)>& change) {
+    std::lock_guard<std::mutex> lock(parameters_mutex_);
+    std::shared_ptr<const ParameterSnapshot> current = std::atomic_load(&published_params_);
+    
+    auto next = std::make_shared<ParameterSnapshot>();
+    next->params = current->params;
+    change(next->params);
+    next->params = detachedCopy(next->params);
+    next->version = current->version + 1;
+    std::atomic_store(&published_params_, std::shared_ptr<const ParameterSnapshot>(next));
+}
+
+// Takes the latest snapshot for the frame about to run. The tables that
+// depend only on the parameters are rebuilt here, when the version moves.
+void ISPPipeline::refreshParameters() {
+    std::shared_ptr<const ParameterSnapshot> snapshot = std::atomic_load(&published_params_);
+    if (snapshot->version == params_version_) {
+        return;
+    }
+    params_ = snapshot->params;
+    params_version_ = snapshot->version;
+    
+    // Gamma for the STAGED path; gamma and tone mapping, shared by the
+    // three channels, for the FUSED one
+    const float gamma_inv = gammaInverse(params_.gamma);
+    for (int v = 0; v < 256; ++v) {
+        gamma_lut_[v] = cv::saturate_cast<uchar>(std::pow(v / 255.0f, gamma_inv) * 255.0f);
+    }
+    for (int v = 0; v < 256; ++v) {
+        float f = gamma_lut_[v] * (1.0f / 255.0f);
+        f *= params_.exposure;
+        f = f * params_.contrast + params_.brightness;
+        f = std::min(std::max(f, 0.0f), 1.0f);
+        tone_lut_[v] = cv::saturate_cast<uchar>(f * 255.0f);
+    }
+    
+    ccm_enabled_ = params_.color_matrix != cv::Matx33f::eye();
+    ccm_fixed_point_ = colorMatrixQ12(params_.color_matrix, ccm_q12_);
+    
+    // The 16-bit path's table applies gamma as a curve, not through the
+    // 8-bit table, so shadows keep their levels
+    if (params_.high_bit_depth) {
+        tone_lut16_.resize(65536);
+        for (int v = 0; v < 65536; ++v) {
+            float f = std::pow(v * (1.0f / 65535.0f), gamma_inv);
+            f *= params_.exposure;
+            f = f * params_.contrast + params_.brightness;
+            f = std::min(std::max(f, 0.0f), 1.0f);
+            tone_lut16_[v] = cv::saturate_cast<ushort>(f * 65535.0f);
+        }
+    }
 }
 
 void ISPPipeline::calibrateWhiteBalance(const cv::Mat& gray_image) {
@@ -196,24 +1066,28 @@ void ISPPipeline::calibrateWhiteBalance(const cv::Mat& gray_image) {
         float avg_gray = mean[0];
         
         // Simple white balance calibration
-        params_.wb_red = avg_gray / 128.0f;
-        params_.wb_green = avg_gray / 128.0f;
-        params_.wb_blue = avg_gray / 128.0f;
+        updateParameters([&](ISPParameters& params) {
+            params.wb_red = avg_gray / 128.0f;
+            params.wb_green = avg_gray / 128.0f;
+            params.wb_blue = avg_gray / 128.0f;
+        });
     }
 }
 
 void ISPPipeline::loadColorMatrix(const std::string& filename) {
     cv::FileStorage fs(filename, cv::FileStorage::READ);
     if (fs.isOpened()) {
-        fs["ColorMatrix"] >> params_.color_matrix;
+        cv::Matx33f color_matrix;
+        fs["ColorMatrix"] >> color_matrix;
         fs.release();
+        updateParameters([&](ISPParameters& params) { params.color_matrix = color_matrix; });
     }
 }
 
 void ISPPipeline::saveColorMatrix(const std::string& filename) {
     cv::FileStorage fs(filename, cv::FileStorage::WRITE);
     if (fs.isOpened()) {
-        fs << "ColorMatrix" << params_.color_matrix;
+        fs << "ColorMatrix" << getParameters().color_matrix;
         fs.release();
     }
 }
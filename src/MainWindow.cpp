@@ -3,6 +3,8 @@
 #include "ISPPipeline.h"
 #include "CalibrationEngine.h"
 #include "ProcessingThread.h"
+#include "DeviceMonitor.h"
+#include "CaptureGroup.h"
 
 #include <QApplication>
 #include <QMainWindow>
@@ -25,8 +27,14 @@
 #include <QSettings>
 #include <QCloseEvent>
 #include <QTimer>
+#include <QStandardPaths>
+#include <QDir>
 #include <QGraphicsScene>
 #include <QGraphicsView>
+#include <QStatusBar>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 
 MainWindow::MainWindow(QWidget* parent) 
     : QMainWindow(parent) {
@@ -41,20 +49,33 @@ MainWindow::MainWindow(QWidget* parent)
     setupConnections();
     loadSettings();
     
-    // Setup timer for camera list refresh
-    camera_refresh_timer_ = new QTimer(this);
-    connect(camera_refresh_timer_, &QTimer::timeout, 
-            this, &MainWindow::updateCameraList);
-    camera_refresh_timer_->start(5000); // Refresh every 5 seconds
+    // Cameras are probed and hotplug-tracked off the GUI thread; the list
+    // fills in as cameraAdded() arrives.
+    device_monitor_ = new DeviceMonitor(this);
+    device_monitor_->loadCache(capabilityCachePath());
+    connect(device_monitor_, &DeviceMonitor::cameraAdded,
+            this, &MainWindow::onCameraAdded);
+    connect(device_monitor_, &DeviceMonitor::cameraRemoved,
+            this, &MainWindow::onCameraRemoved);
+    device_monitor_->start();
     
     updateCameraList();
 }
 
 MainWindow::~MainWindow() {
     processing_thread_->stopCapture();
+    releaseCaptureGroup();
+    device_monitor_->stop();
+    device_monitor_->saveCache(capabilityCachePath());
     saveSettings();
 }
 
+std::string MainWindow::capabilityCachePath() const {
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QDir().mkpath(dir);
+    return (dir + "/camera_capabilities.yml").toStdString();
+}
+
 void MainWindow::setupUI() {
     QWidget* central_widget = new QWidget(this);
     setCentralWidget(central_widget);
@@ -69,6 +90,15 @@ void MainWindow::setupUI() {
     resolution_combo_ = new QComboBox(camera_group);
     fps_combo_ = new QComboBox(camera_group);
     
+    // Applied on the next start
+    delivery_combo_ = new QComboBox(camera_group);
+    delivery_combo_->addItem("Latest frame", CameraCapture::DELIVER_LATEST);
+    delivery_combo_->addItem("Every frame", CameraCapture::DELIVER_ALL);
+    buffer_count_spin_ = new QSpinBox(camera_group);
+    buffer_count_spin_->setRange(2, 16);
+    buffer_count_spin_->setValue(4);
+    sync_group_check_ = new QCheckBox("Sync all cameras", camera_group);
+    
     start_stop_button_ = new QPushButton("Start", camera_group);
     calibration_capture_button_ = new QPushButton("Capture Calibration", camera_group);
     calibrate_button_ = new QPushButton("Calibrate", camera_group);
@@ -81,6 +111,11 @@ void MainWindow::setupUI() {
     camera_layout->addWidget(resolution_combo_);
     camera_layout->addWidget(new QLabel("FPS:"));
     camera_layout->addWidget(fps_combo_);
+    camera_layout->addWidget(new QLabel("Delivery:"));
+    camera_layout->addWidget(delivery_combo_);
+    camera_layout->addWidget(new QLabel("Buffers:"));
+    camera_layout->addWidget(buffer_count_spin_);
+    camera_layout->addWidget(sync_group_check_);
     camera_layout->addWidget(start_stop_button_);
     camera_layout->addWidget(calibration_capture_button_);
     camera_layout->addWidget(calibrate_button_);
@@ -136,12 +171,25 @@ void MainWindow::setupUI() {
     denoise_check_ = new QCheckBox("Enable Denoising", isp_tab);
     denoise_check_->setChecked(true);
     
+    denoise_mode_combo_ = new QComboBox(isp_tab);
+    denoise_mode_combo_->addItem("Temporal (live)");
+    denoise_mode_combo_->addItem("Non-local means (stills)");
+    denoise_mode_combo_->addItem("Guided filter");
+    denoise_mode_combo_->addItem("Bilateral grid");
+    
     sharpen_check_ = new QCheckBox("Enable Sharpening", isp_tab);
     sharpen_check_->setChecked(true);
     
     lens_correction_check_ = new QCheckBox("Lens Correction", isp_tab);
     lens_correction_check_->setChecked(false);
     
+    raw_isp_check_ = new QCheckBox("Raw Sensor ISP (applies on next start)", isp_tab);
+    raw_isp_check_->setChecked(false);
+    
+    load_lut_button_ = new QPushButton("Load Color LUT...", isp_tab);
+    clear_lut_button_ = new QPushButton("Clear Color LUT", isp_tab);
+    clear_lut_button_->setEnabled(false);
+    
     isp_layout->addRow("Exposure:", exposure_spin_);
     isp_layout->addRow("Contrast:", contrast_spin_);
     isp_layout->addRow("Brightness:", brightness_spin_);
@@ -150,8 +198,11 @@ void MainWindow::setupUI() {
     isp_layout->addRow("WB Blue:", wb_blue_slider_);
     isp_layout->addRow("", auto_wb_check_);
     isp_layout->addRow("", denoise_check_);
+    isp_layout->addRow("Denoise Mode:", denoise_mode_combo_);
     isp_layout->addRow("", sharpen_check_);
     isp_layout->addRow("", lens_correction_check_);
+    isp_layout->addRow("", raw_isp_check_);
+    isp_layout->addRow(load_lut_button_, clear_lut_button_);
     
     // Calibration Tab
     QWidget* calib_tab = new QWidget(tab_widget_);
@@ -166,6 +217,9 @@ void MainWindow::setupUI() {
     
     main_layout->addWidget(tab_widget_);
     
+    stats_label_ = new QLabel(this);
+    statusBar()->addPermanentWidget(stats_label_);
+    
     setWindowTitle("Camera Calibration & ISP Pipeline");
     resize(1024, 768);
 }
@@ -174,6 +228,8 @@ void MainWindow::setupConnections() {
     // Camera connections
     connect(camera_combo_, QOverload<int>::of(&QComboBox::currentIndexChanged),
             this, &MainWindow::onCameraSelected);
+    connect(resolution_combo_, QOverload<int>::of(&QComboBox::currentIndexChanged),
+            this, &MainWindow::onResolutionSelected);
     connect(start_stop_button_, &QPushButton::clicked,
             this, &MainWindow::onStartStopClicked);
     connect(calibration_capture_button_, &QPushButton::clicked,
@@ -202,10 +258,18 @@ void MainWindow::setupConnections() {
             this, &MainWindow::onISPParameterChanged);
     connect(denoise_check_, &QCheckBox::stateChanged,
             this, &MainWindow::onISPParameterChanged);
+    connect(denoise_mode_combo_, QOverload<int>::of(&QComboBox::currentIndexChanged),
+            this, &MainWindow::onISPParameterChanged);
     connect(sharpen_check_, &QCheckBox::stateChanged,
             this, &MainWindow::onISPParameterChanged);
     connect(lens_correction_check_, &QCheckBox::stateChanged,
             this, &MainWindow::onISPParameterChanged);
+    connect(raw_isp_check_, &QCheckBox::toggled,
+            this, &MainWindow::onRawISPToggled);
+    connect(load_lut_button_, &QPushButton::clicked,
+            this, &MainWindow::onLoadColorLUTClicked);
+    connect(clear_lut_button_, &QPushButton::clicked,
+            this, &MainWindow::onClearColorLUTClicked);
     
     // Processing thread connections
     processing_thread_->setCamera(camera_);
@@ -223,26 +287,62 @@ void MainWindow::setupConnections() {
 }
 
 void MainWindow::updateCameraList() {
-    auto cameras = camera_->listAvailableCameras();
-    
-    int current_index = camera_combo_->currentIndex();
-    QString current_text = camera_combo_->currentText();
+    // Rebuild from the monitor's list without probing; keep the selection
+    int selected_id = camera_combo_->count() > 0 ? camera_combo_->currentData().toInt()
+                                                 : preferred_camera_id_;
     
+    camera_combo_->blockSignals(true);
     camera_combo_->clear();
     
-    for (const auto& cam : cameras) {
-        camera_combo_->addItem(QString::fromStdString(cam.name), cam.id);
+    for (const auto& cam : cameras_) {
+        QString label = QString::fromStdString(cam.name);
+        if (!cam.device_path.empty()) {
+            label += QString(" (%1)").arg(QString::fromStdString(cam.device_path));
+        }
+        camera_combo_->addItem(label, cam.id);
+    }
+    
+    int index = camera_combo_->findData(selected_id);
+    if (index < 0 && camera_combo_->count() > 0) {
+        index = 0;
     }
+    camera_combo_->setCurrentIndex(index);
+    camera_combo_->blockSignals(false);
     
-    if (camera_combo_->count() > 0) {
-        if (current_index >= 0 && current_index < camera_combo_->count() &&
-            camera_combo_->itemText(current_index) == current_text) {
-            camera_combo_->setCurrentIndex(current_index);
-        } else {
-            camera_combo_->setCurrentIndex(0);
-            onCameraSelected(0);
-        }
+    if (index >= 0 && (camera_combo_->itemData(index).toInt() != selected_id ||
+                       resolution_combo_->count() == 0)) {
+        onCameraSelected(index);
     }
+    updateCameraControls();
+}
+
+void MainWindow::onCameraAdded(const CameraCapture::CameraInfo& info) {
+    auto it = std::find_if(cameras_.begin(), cameras_.end(),
+        [&info](const CameraCapture::CameraInfo& cam) { return cam.id >= info.id; });
+    if (it != cameras_.end() && it->id == info.id) {
+        *it = info;
+    } else {
+        cameras_.insert(it, info);
+    }
+    
+    updateCameraList();
+}
+
+void MainWindow::onCameraRemoved(int camera_id) {
+    cameras_.erase(std::remove_if(cameras_.begin(), cameras_.end(),
+        [camera_id](const CameraCapture::CameraInfo& cam) { return cam.id == camera_id; }),
+        cameras_.end());
+    
+    if (is_capturing_ && camera_combo_->currentData().toInt() == camera_id) {
+        processing_thread_->stopCapture();
+        releaseCaptureGroup();
+        camera_->shutdown();
+        start_stop_button_->setText("Start");
+        is_capturing_ = false;
+        statusBar()->showMessage("Camera disconnected", 5000);
+    }
+    
+    updateCameraList();
 }
 
 void MainWindow::onCameraSelected(int index) {
@@ -252,14 +352,15 @@ void MainWindow::onCameraSelected(int index) {
         // Stop current capture
         if (is_capturing_) {
             processing_thread_->stopCapture();
+            releaseCaptureGroup();
             start_stop_button_->setText("Start");
             is_capturing_ = false;
         }
         
-        // Update resolution combo
+        // Update resolution combo from the cached capabilities
+        resolution_combo_->blockSignals(true);
         resolution_combo_->clear();
-        auto cameras = camera_->listAvailableCameras();
-        for (const auto& cam : cameras) {
+        for (const auto& cam : cameras_) {
             if (cam.id == camera_id) {
                 for (const auto& res : cam.resolutions) {
                     QString res_str = QString("%1x%2").arg(res.first).arg(res.second);
@@ -270,24 +371,92 @@ void MainWindow::onCameraSelected(int index) {
         }
         
         if (resolution_combo_->count() > 0) {
-            resolution_combo_->setCurrentIndex(0);
+            // Prefer 640x480 if offered, as initialize() defaults to it
+            int default_index = resolution_combo_->findText("640x480");
+            resolution_combo_->setCurrentIndex(std::max(default_index, 0));
         }
+        resolution_combo_->blockSignals(false);
+        onResolutionSelected(resolution_combo_->currentIndex());
         
-        // Update FPS combo
-        fps_combo_->clear();
-        std::vector<int> fps_options = {15, 30, 60};
-        for (int fps : fps_options) {
+        initializeCamera();
+    }
+}
+
+void MainWindow::onResolutionSelected(int index) {
+    int camera_id = camera_combo_->currentData().toInt();
+    std::vector<double> rates;
+    if (index >= 0) {
+        auto res = resolution_combo_->itemData(index).value<std::pair<int, int>>();
+        for (const auto& cam : cameras_) {
+            if (cam.id == camera_id) {
+                rates = cam.frameRates(res.first, res.second);
+                break;
+            }
+        }
+    }
+    
+    // Devices that do not enumerate intervals get the usual choices
+    if (rates.empty()) {
+        rates = {60, 30, 15};
+    }
+    
+    fps_combo_->clear();
+    for (double rate : rates) {
+        int fps = static_cast<int>(std::lround(rate));
+        if (fps > 0 && fps_combo_->findData(fps) < 0) {
             fps_combo_->addItem(QString::number(fps), fps);
         }
-        fps_combo_->setCurrentIndex(1); // 30 FPS
-        
-        initializeCamera();
     }
+    
+    int default_index = fps_combo_->findData(30);
+    fps_combo_->setCurrentIndex(default_index >= 0 ? default_index : 0);
 }
 
 void MainWindow::onStartStopClicked() {
     if (!is_capturing_) {
-        if (camera_->initialize(camera_combo_->currentData().toInt())) {
+        CameraCapture::CaptureOptions options = camera_->getCaptureOptions();
+        options.buffer_count = buffer_count_spin_->value();
+        options.delivery = static_cast<CameraCapture::DeliveryPolicy>(
+            delivery_combo_->currentData().toInt());
+        camera_->setCaptureOptions(options);
+        
+        int width = 640;
+        int height = 480;
+        if (resolution_combo_->currentIndex() >= 0) {
+            auto res = resolution_combo_->currentData().value<std::pair<int, int>>();
+            width = res.first;
+            height = res.second;
+        }
+        int fps = fps_combo_->count() > 0 ? fps_combo_->currentData().toInt() : 30;
+        
+        // A synchronized group needs fds to wait on, so its leader is
+        // opened on V4L2 like the other members
+        const bool sync_group = sync_group_check_->isChecked();
+        if (camera_->initialize(camera_combo_->currentData().toInt(), 
+                                width, height, fps,
+                                sync_group ? CameraCapture::V4L2 : CameraCapture::AUTO)) {
+            // The selected camera leads the group; up to three more join it
+            capture_group_.reset();
+            if (sync_group) {
+                auto group = std::make_shared<CaptureGroup>();
+                group->addCamera(camera_);
+                for (const auto& cam : cameras_) {
+                    if (group->size() >= 4) break;
+                    if (cam.id == camera_combo_->currentData().toInt()) continue;
+                    
+                    auto member = std::make_shared<CameraCapture>();
+                    member->setCaptureOptions(options);
+                    if (member->initialize(cam.id, width, height, fps, CameraCapture::V4L2)) {
+                        group->addCamera(member);
+                        group_cameras_.push_back(member);
+                    }
+                }
+                if (group->size() >= 2) {
+                    capture_group_ = group;
+                }
+            }
+            processing_thread_->setCaptureGroup(capture_group_);
+            
             processing_thread_->startCapture();
             start_stop_button_->setText("Stop");
             is_capturing_ = true;
@@ -296,11 +465,21 @@ void MainWindow::onStartStopClicked() {
         }
     } else {
         processing_thread_->stopCapture();
+        releaseCaptureGroup();
         start_stop_button_->setText("Start");
         is_capturing_ = false;
     }
 }
 
+void MainWindow::releaseCaptureGroup() {
+    capture_group_.reset();
+    processing_thread_->setCaptureGroup(nullptr);
+    for (auto& camera : group_cameras_) {
+        camera->shutdown();
+    }
+    group_cameras_.clear();
+}
+
 void MainWindow::onCaptureCalibrationClicked() {
     if (calib_engine_->getNumCalibrationImages() >= 20) {
         QMessageBox::information(this, "Info", 
@@ -333,6 +512,7 @@ void MainWindow::onCalibrateClicked() {
         auto isp_params = isp_pipeline_->getParameters();
         isp_params.camera_matrix = result.camera_matrix;
         isp_params.distortion_coeffs = result.distortion_coeffs;
+        isp_params.lens_calibration_size = result.image_size;
         isp_pipeline_->setParameters(isp_params);
         
         updateISPControls();
@@ -371,6 +551,7 @@ void MainWindow::onLoadCalibrationClicked() {
             auto isp_params = isp_pipeline_->getParameters();
             isp_params.camera_matrix = result.camera_matrix;
             isp_params.distortion_coeffs = result.distortion_coeffs;
+            isp_params.lens_calibration_size = result.image_size;
             isp_pipeline_->setParameters(isp_params);
             
             updateISPControls();
@@ -393,16 +574,101 @@ void MainWindow::onISPParameterChanged() {
     params.wb_blue = wb_blue_slider_->value() / 100.0f;
     params.auto_wb = auto_wb_check_->isChecked();
     
+    // Auto white balance publishes its own gains; the sliders are manual
+    wb_red_slider_->setEnabled(!params.auto_wb);
+    wb_green_slider_->setEnabled(!params.auto_wb);
+    wb_blue_slider_->setEnabled(!params.auto_wb);
+    
     params.denoise_enabled = denoise_check_->isChecked();
+    params.denoise_mode = static_cast<ISPPipeline::ISPParameters::DenoiseMode>(
+        denoise_mode_combo_->currentIndex());
     params.sharpen_enabled = sharpen_check_->isChecked();
     params.lens_correction = lens_correction_check_->isChecked();
     
     isp_pipeline_->setParameters(params);
 }
 
-void MainWindow::onFrameProcessed(const QImage& image) {
+void MainWindow::onRawISPToggled(bool enabled) {
+    // Raw capture is negotiated at initialize(), so this takes effect on the
+    // next start; cameras without Bayer output fall back to the normal path.
+    camera_->setPreferredFormat(enabled ? CameraCapture::FORMAT_RAW12 
+                                        : CameraCapture::FORMAT_AUTO);
+    processing_thread_->setProcessingMode(enabled ? ProcessingThread::MODE_RAW_ISP
+                                                  : ProcessingThread::MODE_PREVIEW);
+}
+
+void MainWindow::onLoadColorLUTClicked() {
+    QString filename = QFileDialog::getOpenFileName(this,
+        "Load Color LUT", "", "3D LUT Files (*.cube)");
+    
+    if (!filename.isEmpty()) {
+        if (isp_pipeline_->loadColorLUT(filename.toStdString())) {
+            // Grades only run on the baked 3D LUT path
+            auto params = isp_pipeline_->getParameters();
+            params.color_path = ISPPipeline::ISPParameters::ColorPath::LUT_3D;
+            isp_pipeline_->setParameters(params);
+            clear_lut_button_->setEnabled(true);
+        } else {
+            QMessageBox::warning(this, "Error", 
+                               "Failed to load color LUT");
+        }
+    }
+}
+
+void MainWindow::onClearColorLUTClicked() {
+    isp_pipeline_->clearColorLUT();
+    
+    auto params = isp_pipeline_->getParameters();
+    params.color_path = ISPPipeline::ISPParameters::ColorPath::FUSED;
+    isp_pipeline_->setParameters(params);
+    clear_lut_button_->setEnabled(false);
+}
+
+void MainWindow::onFrameProcessed(const QImage& image, qint64 capture_timestamp_ns) {
     display_label_->setPixmap(QPixmap::fromImage(image).scaled(
         display_label_->size(), Qt::KeepAspectRatio, Qt::SmoothTransformation));
+    processing_thread_->frameDisplayed();
+    
+    // Later frames go through the ISP at the size they are shown at,
+    // which follows the window
+    const qreal ratio = display_label_->devicePixelRatioF();
+    processing_thread_->setPreviewSize(qRound(display_label_->width() * ratio),
+                                       qRound(display_label_->height() * ratio));
+    
+    // Timestamps are on the monotonic clock, same as steady_clock here
+    qint64 now_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    double latency_ms = (now_ns - capture_timestamp_ns) / 1.0e6;
+    display_latency_ms_ = display_latency_ms_ > 0.0 
+                        ? 0.9 * display_latency_ms_ + 0.1 * latency_ms
+                        : latency_ms;
+    
+    if (!stats_refresh_timer_.isValid() || stats_refresh_timer_.elapsed() > 250) {
+        stats_refresh_timer_.restart();
+        updateStatsLabel();
+    }
+}
+
+void MainWindow::updateStatsLabel() {
+    auto stats = camera_->getStats();
+    stats_label_->setText(QString("Latency: %1 ms | Queue: %6/%7 | Frames: %2 | "
+                                  "Dropped - driver: %3, queue: %4, display: %5")
+                          .arg(display_latency_ms_, 0, 'f', 1)
+                          .arg(stats.frames_captured)
+                          .arg(stats.dropped_by_driver)
+                          .arg(stats.dropped_by_queue)
+                          .arg(stats.dropped_by_display)
+                          .arg(processing_thread_->queueDepth())
+                          .arg(processing_thread_->queueCapacity()));
+    
+    if (capture_group_) {
+        auto sync = capture_group_->getStats();
+        stats_label_->setText(stats_label_->text() + 
+                              QString(" | Sync: %1 sets, %2 incomplete, max skew %3 ms")
+                              .arg(sync.framesets)
+                              .arg(sync.incomplete)
+                              .arg(sync.max_skew_ns / 1.0e6, 0, 'f', 1));
+    }
 }
 
 void MainWindow::onCalibrationFrameAdded(int count) {
@@ -450,6 +716,7 @@ void MainWindow::updateISPControls() {
     
     auto_wb_check_->setChecked(params.auto_wb);
     denoise_check_->setChecked(params.denoise_enabled);
+    denoise_mode_combo_->setCurrentIndex(static_cast<int>(params.denoise_mode));
     sharpen_check_->setChecked(params.sharpen_enabled);
     lens_correction_check_->setChecked(params.lens_correction);
 }
@@ -470,12 +737,15 @@ void MainWindow::saveSettings() {
     settings.setValue("isp/wb_blue", params.wb_blue);
     settings.setValue("isp/auto_wb", params.auto_wb);
     settings.setValue("isp/denoise", params.denoise_enabled);
+    settings.setValue("isp/denoise_mode", static_cast<int>(params.denoise_mode));
     settings.setValue("isp/sharpen", params.sharpen_enabled);
     
     // Save camera selection
     if (camera_combo_->count() > 0) {
-        settings.setValue("camera/index", camera_combo_->currentIndex());
+        settings.setValue("camera/id", camera_combo_->currentData().toInt());
     }
+    settings.setValue("camera/delivery", delivery_combo_->currentIndex());
+    settings.setValue("camera/buffers", buffer_count_spin_->value());
 }
 
 void MainWindow::loadSettings() {
@@ -495,20 +765,22 @@ void MainWindow::loadSettings() {
     params.wb_blue = settings.value("isp/wb_blue", 1.0).toFloat();
     params.auto_wb = settings.value("isp/auto_wb", true).toBool();
     params.denoise_enabled = settings.value("isp/denoise", true).toBool();
+    params.denoise_mode = static_cast<ISPPipeline::ISPParameters::DenoiseMode>(
+        settings.value("isp/denoise_mode", 0).toInt());
     params.sharpen_enabled = settings.value("isp/sharpen", true).toBool();
     
     isp_pipeline_->setParameters(params);
     updateISPControls();
     
-    // Load camera selection
-    int camera_index = settings.value("camera/index", 0).toInt();
-    if (camera_index >= 0 && camera_index < camera_combo_->count()) {
-        camera_combo_->setCurrentIndex(camera_index);
-    }
+    // Applied when that camera shows up in the list
+    preferred_camera_id_ = settings.value("camera/id", 0).toInt();
+    delivery_combo_->setCurrentIndex(settings.value("camera/delivery", 0).toInt());
+    buffer_count_spin_->setValue(settings.value("camera/buffers", 4).toInt());
 }
 
 void MainWindow::closeEvent(QCloseEvent* event) {
     processing_thread_->stopCapture();
+    releaseCaptureGroup();
     saveSettings();
     event->accept();
 }
\ No newline at end of file
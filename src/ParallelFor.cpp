@@ -0,0 +1,161 @@
+#include "ParallelFor.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace {
+
+// Set on the workers, and on a caller while it runs stripes
+thread_local bool in_parallel_region = false;
+
+// One job at a time. The caller publishes it under mutex_ and wakes the
+// workers; each claims stripes off next_stripe_ until none are left, and
+// the last one to finish wakes the caller. Nothing is allocated per job.
+class WorkerPool {
+public:
+    static WorkerPool& instance() {
+        static WorkerPool pool;
+        return pool;
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            quit_ = true;
+        }
+        wake_.notify_all();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+    }
+
+    int workers() const { return static_cast<int>(threads_.size()); }
+
+    // False when another thread's job holds the pool
+    bool tryRun(const cv::Range& range, const cv::ParallelLoopBody& body, int stripes) {
+        std::unique_lock<std::mutex> run(run_mutex_, std::try_to_lock);
+        if (!run.owns_lock()) {
+            return false;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            body_ = &body;
+            range_ = range;
+            stripes_ = stripes;
+            next_stripe_ = 0;
+            error_ = nullptr;
+            joining_ = std::min(std::min(workers(), cv::getNumThreads() - 1), stripes - 1);
+            active_ = joining_;
+            ++generation_;
+        }
+        wake_.notify_all();
+
+        in_parallel_region = true;
+        work();
+        in_parallel_region = false;
+
+        std::exception_ptr error;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            done_.wait(lock, [this]() { return active_ == 0; });
+            body_ = nullptr;
+            std::swap(error, error_);
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return true;
+    }
+
+private:
+    WorkerPool() {
+        const int count = std::max(cv::getNumberOfCPUs() - 1, 0);
+        threads_.reserve(count);
+        for (int i = 0; i < count; ++i) {
+            threads_.emplace_back([this]() { workerLoop(); });
+        }
+    }
+
+    void workerLoop() {
+        in_parallel_region = true;
+        uint64_t seen = 0;
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            wake_.wait(lock, [&]() { return quit_ || (generation_ != seen && joining_ > 0); });
+            if (quit_) {
+                return;
+            }
+            seen = generation_;
+            joining_--;
+
+            lock.unlock();
+            work();
+            lock.lock();
+
+            if (--active_ == 0) {
+                done_.notify_one();
+            }
+        }
+    }
+
+    void work() {
+        const int64_t length = range_.end - range_.start;
+        while (true) {
+            const int stripe = next_stripe_++;
+            if (stripe >= stripes_) {
+                return;
+            }
+            const cv::Range part(range_.start + static_cast<int>(length * stripe / stripes_),
+                                 range_.start + static_cast<int>(length * (stripe + 1) / stripes_));
+            try {
+                (*body_)(part);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (!error_) {
+                    error_ = std::current_exception();
+                }
+            }
+        }
+    }
+
+    std::vector<std::thread> threads_;
+    std::mutex run_mutex_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    uint64_t generation_ = 0;
+    bool quit_ = false;
+    int joining_ = 0;       // workers still to pick up the job
+    int active_ = 0;        // workers that have not finished it
+
+    const cv::ParallelLoopBody* body_ = nullptr;
+    cv::Range range_;
+    int stripes_ = 0;
+    std::atomic<int> next_stripe_{0};
+    std::exception_ptr error_;
+};
+
+} // namespace
+
+void runParallel(const cv::Range& range, const cv::ParallelLoopBody& body, double nstripes) {
+    const int length = range.end - range.start;
+    if (length <= 0) {
+        return;
+    }
+
+    // Four stripes a thread by default, so uneven rows even out
+    WorkerPool& pool = WorkerPool::instance();
+    const int stripes = nstripes > 0.0
+        ? std::min(length, cvCeil(nstripes))
+        : std::min(length, (pool.workers() + 1) * 4);
+    if (stripes <= 1 || in_parallel_region || cv::getNumThreads() <= 1 ||
+        !pool.tryRun(range, body, stripes)) {
+        body(range);
+    }
+}
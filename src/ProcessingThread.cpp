@@ -6,6 +6,7 @@
 #include <QDir>
 #include <QDateTime>
 #include <opencv2/imgproc.hpp>
+#include <algorithm>
 
 ProcessingThread::ProcessingThread(QObject* parent) 
     : QThread(parent) {}
@@ -16,27 +17,67 @@ ProcessingThread::~ProcessingThread() {
 }
 
 void ProcessingThread::setCamera(std::shared_ptr<CameraCapture> camera) {
-    std::lock_guard<std::mutex> lock(mutex_);
+    QMutexLocker lock(&mutex_);
     camera_ = camera;
 }
 
 void ProcessingThread::setISPPipeline(std::shared_ptr<ISPPipeline> isp) {
-    std::lock_guard<std::mutex> lock(mutex_);
+    QMutexLocker lock(&mutex_);
     isp_pipeline_ = isp;
 }
 
 void ProcessingThread::setCalibrationEngine(std::shared_ptr<CalibrationEngine> calib) {
-    std::lock_guard<std::mutex> lock(mutex_);
+    QMutexLocker lock(&mutex_);
     calib_engine_ = calib;
 }
 
+void ProcessingThread::setCaptureGroup(std::shared_ptr<CaptureGroup> group) {
+    QMutexLocker lock(&mutex_);
+    capture_group_ = group;
+}
+
 void ProcessingThread::setProcessingMode(ProcessingMode mode) {
-    std::lock_guard<std::mutex> lock(mutex_);
+    QMutexLocker lock(&mutex_);
     processing_mode_ = mode;
 }
 
+void ProcessingThread::setPreviewSize(int width, int height) {
+    preview_width_ = std::max(width, 0);
+    preview_height_ = std::max(height, 0);
+}
+
+// The size a frame is reduced to for display, keeping its aspect ratio,
+// when the display (split between views side by side) is smaller than it;
+// empty otherwise
+cv::Size ProcessingThread::previewSize(cv::Size frame, int views) const {
+    const int width = preview_width_ / std::max(views, 1);
+    const int height = preview_height_;
+    if (width <= 0 || height <= 0 || frame.empty()) {
+        return cv::Size();
+    }
+    
+    const double scale = std::min(static_cast<double>(width) / frame.width,
+                                  static_cast<double>(height) / frame.height);
+    if (scale >= 1.0) {
+        return cv::Size();
+    }
+    return cv::Size(std::max(1, cvRound(frame.width * scale)),
+                    std::max(1, cvRound(frame.height * scale)));
+}
+
+// frame, or frame area-resized into reduced when the display is smaller
+const cv::Mat& ProcessingThread::previewInput(const cv::Mat& frame, cv::Mat& reduced, 
+                                              int views) const {
+    const cv::Size size = previewSize(frame.size(), views);
+    if (size.empty()) {
+        return frame;
+    }
+    cv::resize(frame, reduced, size, 0, 0, cv::INTER_AREA);
+    return reduced;
+}
+
 void ProcessingThread::setSaveDirectory(const std::string& directory) {
-    std::lock_guard<std::mutex> lock(mutex_);
+    QMutexLocker lock(&mutex_);
     save_directory_ = directory;
     
     // Create directory if it doesn't exist
@@ -50,6 +91,50 @@ void ProcessingThread::startCapture() {
     if (!capturing_) {
         capturing_ = true;
         stop_requested_ = false;
+        frames_in_flight_ = 0;
+        
+        std::shared_ptr<CameraCapture> camera;
+        std::shared_ptr<CaptureGroup> group;
+        {
+            QMutexLocker lock(&mutex_);
+            camera = camera_;
+            group = capture_group_;
+            frame_set_pending_ = false;
+            pending_set_ = CaptureGroup::FrameSet();
+        }
+        
+        // Framesets come from the group's reactor thread
+        if (group && group->size() >= 2) {
+            running_group_ = group;
+            group->setFrameSetCallback(
+                [this](const CaptureGroup::FrameSet& set) { onFrameSetAvailable(set); });
+            if (!group->start()) {
+                emit errorOccurred("Failed to start synchronized capture");
+            }
+            start();
+            return;
+        }
+        
+        // Leave the driver two buffers (one filling, one in processing);
+        // queued frames beyond that are copied out of the mmap buffers.
+        if (camera) {
+            const CameraCapture::CaptureOptions& options = camera->getCaptureOptions();
+            frame_queue_.configure(options.delivery, 
+                                   static_cast<size_t>(std::max(options.queue_capacity, 1)),
+                                   static_cast<size_t>(std::max(camera->getBufferCount() - 2, 1)));
+        }
+        frame_queue_.reopen();
+        
+        // Frames are pushed from the camera's capture thread
+        if (camera && camera->isInitialized()) {
+            streaming_camera_ = camera;
+            consumer_id_ = camera->addFrameConsumer(
+                [this](const CameraCapture::FrameLease& lease) { onFrameAvailable(lease); });
+            if (!camera->startStreaming()) {
+                emit errorOccurred("Failed to start camera streaming");
+            }
+        }
+        
         start();
     }
 }
@@ -57,75 +142,259 @@ void ProcessingThread::startCapture() {
 void ProcessingThread::stopCapture() {
     if (capturing_) {
         capturing_ = false;
+        
+        // Closing the queue releases a producer blocked on a full queue, so
+        // the capture thread can be joined, and wakes the processing thread.
         stop_requested_ = true;
-        condition_.wakeAll();
+        frame_queue_.close();
+        
+        if (running_group_) {
+            running_group_->stop();
+        }
+        {
+            QMutexLocker lock(&mutex_);
+            pending_set_ = CaptureGroup::FrameSet();
+            frame_set_pending_ = false;
+            frame_set_ready_.wakeAll();
+        }
+        
+        if (streaming_camera_) {
+            streaming_camera_->removeFrameConsumer(consumer_id_);
+            streaming_camera_->stopStreaming();
+            streaming_camera_.reset();
+        }
+        
         wait();
+        running_group_.reset();
     }
 }
 
 void ProcessingThread::captureCalibrationFrame() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (calib_engine_ && calib_engine_->getNumCalibrationImages() < max_calibration_frames_) {
-        cv::Mat frame;
-        if (camera_ && camera_->captureFrame(frame) && !frame.empty()) {
-            // Process in calibration mode
-            processFrame(frame);
-        }
-    }
+    // Taken from the next frame the processing thread sees
+    calibration_capture_requested_ = true;
 }
 
 void ProcessingThread::captureRawFrame() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    cv::Mat frame;
-    if (camera_ && camera_->captureFrame(frame) && !frame.empty()) {
-        // Save raw frame
-        QString filename = QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss_zzz");
-        QString filepath = QString::fromStdString(save_directory_) + 
-                          "/raw_" + filename + ".png";
-        cv::imwrite(filepath.toStdString(), frame);
+    raw_capture_requested_ = true;
+}
+
+void ProcessingThread::onFrameAvailable(const CameraCapture::FrameLease& lease) {
+    // In latest-frame mode a newer frame replaces an unprocessed one
+    size_t dropped = frame_queue_.push(lease);
+    if (dropped > 0 && streaming_camera_) {
+        streaming_camera_->recordQueueDrop(dropped);
+    }
+}
+
+void ProcessingThread::onFrameSetAvailable(const CaptureGroup::FrameSet& set) {
+    QMutexLocker lock(&mutex_);
+    
+    // Only the newest set is kept, as with single-camera preview
+    if (frame_set_pending_ && running_group_ && running_group_->camera(0)) {
+        running_group_->camera(0)->recordQueueDrop();
     }
+    pending_set_ = set;
+    frame_set_pending_ = true;
+    frame_set_ready_.wakeOne();
 }
 
 void ProcessingThread::run() {
-    while (!stop_requested_) {
-        mutex_.lock();
+    while (running_group_) {
+        CaptureGroup::FrameSet set;
+        {
+            QMutexLocker lock(&mutex_);
+            while (!frame_set_pending_ && !stop_requested_) {
+                frame_set_ready_.wait(&mutex_);
+            }
+            if (stop_requested_) {
+                break;
+            }
+            set = pending_set_;
+            pending_set_ = CaptureGroup::FrameSet();
+            frame_set_pending_ = false;
+        }
         
-        if (!camera_ || !camera_->isInitialized()) {
-            mutex_.unlock();
-            msleep(100);
-            continue;
+        processFrameSet(set);
+    }
+    
+    while (!running_group_) {
+        // Process straight out of the driver buffer; it is requeued when
+        // the lease goes out of scope.
+        CameraCapture::FrameLease lease;
+        if (!frame_queue_.pop(lease) || stop_requested_) {
+            break;
         }
         
-        cv::Mat frame;
-        bool frame_captured = camera_->captureFrame(frame);
+        if (processing_mode_ == MODE_RAW_ISP && 
+            CameraCapture::isRawFormat(lease.pixelFormat())) {
+            processRawFrame(lease);
+        } else if (lease.pixelFormat() == CameraCapture::FORMAT_BGR24) {
+            processFrame(lease.image(), lease.metadata());
+        } else if (camera_->convertFrame(lease, input_frame_)) {
+            // Converted into our own buffer; give the driver its buffer back
+            CameraCapture::FrameMetadata metadata = lease.metadata();
+            lease.release();
+            processFrame(input_frame_, metadata);
+        }
+    }
+    
+    capturing_ = false;
+}
+
+void ProcessingThread::processFrameSet(const CaptureGroup::FrameSet& set) {
+    const size_t count = set.frames.size();
+    view_frames_.resize(count);
+    view_outputs_.resize(count);
+    view_previews_.resize(count);
+    
+    // Every view at the height of the first one that arrived
+    cv::Size view_size;
+    const CameraCapture::FrameMetadata* metadata = nullptr;
+    std::vector<cv::Mat> views(count);
+    for (size_t i = 0; i < count; ++i) {
+        const CameraCapture::FrameLease& lease = set.frames[i];
+        std::shared_ptr<CameraCapture> camera = running_group_->camera(i);
+        if (!lease.valid() || !camera || !camera->convertFrame(lease, view_frames_[i])) {
+            continue;
+        }
         
-        mutex_.unlock();
+        if (isp_pipeline_) {
+            isp_pipeline_->selectStream(static_cast<int>(i));
+            isp_pipeline_->processRGB(
+                previewInput(view_frames_[i], view_previews_[i], static_cast<int>(count)),
+                view_outputs_[i]);
+            views[i] = view_outputs_[i];
+        } else {
+            views[i] = view_frames_[i];
+        }
         
-        if (frame_captured && !frame.empty()) {
-            processFrame(frame);
+        if (!metadata) {
+            metadata = &lease.metadata();
+            view_size = views[i].size();
+        }
+    }
+    
+    if (!metadata) {
+        return;
+    }
+    
+    // Missing cameras show as black
+    for (auto& view : views) {
+        if (view.empty()) {
+            view = cv::Mat::zeros(view_size, CV_8UC3);
+        } else if (view.rows != view_size.height) {
+            cv::resize(view, view, cv::Size(view.cols * view_size.height / view.rows, 
+                                            view_size.height), 0, 0, cv::INTER_AREA);
+        }
+    }
+    
+    cv::Mat combined;
+    cv::hconcat(views, combined);
+    emitFrame(combined, *metadata);
+    
+    frame_counter_++;
+}
+
+void ProcessingThread::saveRawFrame(const cv::Mat& frame) {
+    QString filename = QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss_zzz");
+    QString filepath = QString::fromStdString(save_directory_) + 
+                      "/raw_" + filename + ".png";
+    cv::imwrite(filepath.toStdString(), frame);
+}
+
+void ProcessingThread::processRawFrame(const CameraCapture::FrameLease& lease) {
+    // Packed formats unpack into our buffer; the others alias the lease
+    const bool packed = lease.pixelFormat() == CameraCapture::FORMAT_RAW10P ||
+                        lease.pixelFormat() == CameraCapture::FORMAT_RAW12P;
+    cv::Mat bayer;
+    if (!camera_->unpackRawFrame(lease, packed ? raw_frame_ : bayer)) {
+        return;
+    }
+    if (packed) {
+        bayer = raw_frame_;
+    }
+    
+    ISPPipeline::BayerPattern pattern = ISPPipeline::BayerPattern::BGGR;
+    switch (lease.bayerPattern()) {
+        case CameraCapture::BAYER_BGGR: pattern = ISPPipeline::BayerPattern::BGGR; break;
+        case CameraCapture::BAYER_GBRG: pattern = ISPPipeline::BayerPattern::GBRG; break;
+        case CameraCapture::BAYER_GRBG: pattern = ISPPipeline::BayerPattern::GRBG; break;
+        case CameraCapture::BAYER_RGGB: pattern = ISPPipeline::BayerPattern::RGGB; break;
+    }
+    
+    cv::Mat& processed = output_frame_;
+    if (isp_pipeline_) {
+        // Binning by a whole factor keeps the preview at or above the
+        // display size; the display scales the rest
+        const cv::Mat* isp_input = &bayer;
+        const cv::Size preview = previewSize(bayer.size(), 1);
+        if (!preview.empty()) {
+            const int factor = std::min(bayer.cols / preview.width, bayer.rows / preview.height);
+            if (factor >= 2) {
+                BayerDemosaic::bin(bayer, preview_bayer_, factor);
+                isp_input = &preview_bayer_;
+            }
         }
         
-        msleep(1); // Prevent CPU overuse
+        isp_pipeline_->selectStream(0);
+        isp_pipeline_->processRaw(*isp_input, processed, pattern,
+                                  CameraCapture::rawBitDepth(lease.pixelFormat()));
+    } else {
+        camera_->convertFrame(lease, processed);
     }
     
-    capturing_ = false;
+    emitFrame(processed, lease.metadata());
+    
+    // Keep the mosaic at sensor depth (16-bit PNG for 10/12-bit data)
+    if (raw_capture_requested_.exchange(false)) {
+        saveRawFrame(bayer);
+    }
+    
+    frame_counter_++;
 }
 
-void ProcessingThread::processFrame(const cv::Mat& frame) {
-    cv::Mat processed;
+void ProcessingThread::emitFrame(const cv::Mat& processed, 
+                                 const CameraCapture::FrameMetadata& metadata) {
+    // The GUI still has an unpainted frame queued: skip this one rather than
+    // letting queued signals pile up latency behind it.
+    if (frames_in_flight_ >= max_frames_in_flight_) {
+        if (camera_) {
+            camera_->recordDisplayDrop();
+        }
+        return;
+    }
+    
+    frames_in_flight_++;
+    QImage qimage = cvMatToQImage(processed);
+    emit frameProcessed(qimage, static_cast<qint64>(metadata.timestamp_ns));
+}
+
+void ProcessingThread::frameDisplayed() {
+    if (frames_in_flight_ > 0) {
+        frames_in_flight_--;
+    }
+}
+
+void ProcessingThread::processFrame(const cv::Mat& frame,
+                                    const CameraCapture::FrameMetadata& metadata) {
+    cv::Mat& processed = output_frame_;
+    if (isp_pipeline_) {
+        isp_pipeline_->selectStream(0);
+    }
     
     switch (processing_mode_) {
+        case MODE_RAW_ISP:
         case MODE_PREVIEW: {
             if (isp_pipeline_) {
-                isp_pipeline_->processRGB(frame, processed);
+                isp_pipeline_->processRGB(previewInput(frame, preview_frame_), processed);
             } else {
-                processed = frame.clone();
+                frame.copyTo(processed);
             }
             break;
         }
         
         case MODE_CALIBRATION: {
-            processed = frame.clone();
+            frame.copyTo(processed);
             
             if (calib_engine_) {
                 // Try to find chessboard
@@ -148,31 +417,35 @@ void ProcessingThread::processFrame(const cv::Mat& frame) {
             if (calib_engine_ && calib_engine_->isCalibrated()) {
                 calib_engine_->undistortImage(frame, processed);
             } else {
-                processed = frame.clone();
+                frame.copyTo(processed);
             }
             break;
         }
         
         case MODE_RAW_CAPTURE: {
-            processed = frame.clone();
-            
             // Apply minimal processing for display
             if (isp_pipeline_) {
-                isp_pipeline_->processRGB(frame, processed);
+                isp_pipeline_->processRGB(previewInput(frame, preview_frame_), processed);
+            } else {
+                frame.copyTo(processed);
             }
             break;
         }
     }
     
     // Convert to QImage and emit signal
-    QImage qimage = cvMatToQImage(processed);
-    emit frameProcessed(qimage);
+    emitFrame(processed, metadata);
+    
+    if (raw_capture_requested_.exchange(false)) {
+        saveRawFrame(frame);
+    }
     
-    // Handle calibration frame capture
-    if (processing_mode_ == MODE_CALIBRATION && 
-        calib_engine_ && 
+    // Handle calibration frame capture, automatic or on request
+    bool capture_requested = calibration_capture_requested_.exchange(false);
+    if (calib_engine_ && 
         calib_engine_->getNumCalibrationImages() < max_calibration_frames_ &&
-        frame_counter_ % 30 == 0) { // Capture every 30 frames
+        (capture_requested || 
+         (processing_mode_ == MODE_CALIBRATION && frame_counter_ % 30 == 0))) { // Capture every 30 frames
         
         if (calib_engine_->addCalibrationImage(frame, cv::Size(9, 6), 25.0f)) {
             emit calibrationFrameAdded(calib_engine_->getNumCalibrationImages());
@@ -210,8 +483,9 @@ QImage ProcessingThread::cvMatToQImage(const cv::Mat& mat) {
         }
         
         default: {
+            // The display is where a 16-bit ISP output drops to 8 bits
             cv::Mat converted;
-            mat.convertTo(converted, CV_8UC3);
+            mat.convertTo(converted, CV_8U, mat.depth() == CV_16U ? 1.0 / 257.0 : 1.0);
             QImage image(converted.data, converted.cols, converted.rows, 
                         static_cast<int>(converted.step), 
                         QImage::Format_BGR888);
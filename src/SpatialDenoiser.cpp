@@ -0,0 +1,262 @@
+#include "SpatialDenoiser.h"
+#include "ImageKernels.h"
+#include "ParallelFor.h"
+#include <algorithm>
+
+namespace {
+
+// [1 2 1] along one axis of the grid, zero outside it
+void blurGridAxis(const cv::Vec4f* in, cv::Vec4f* out,
+                  int width, int height, int depth, int axis) {
+    const int stride = axis == 0 ? depth : (axis == 1 ? width * depth : 1);
+    const int extent = axis == 0 ? width : (axis == 1 ? height : depth);
+
+    parallelFor(cv::Range(0, height), [&](const cv::Range& range) {
+        for (int y = range.start; y < range.end; ++y) {
+            for (int x = 0; x < width; ++x) {
+                for (int z = 0; z < depth; ++z) {
+                    const int pos = axis == 0 ? x : (axis == 1 ? y : z);
+                    const size_t i = (static_cast<size_t>(y) * width + x) * depth + z;
+                    cv::Vec4f sum = in[i] * 2.0f;
+                    if (pos > 0) sum += in[i - stride];
+                    if (pos + 1 < extent) sum += in[i + stride];
+                    out[i] = sum;
+                }
+            }
+        }
+    });
+}
+
+} // namespace
+
+void SpatialDenoiser::setAllocator(cv::MatAllocator* allocator) {
+    for (cv::Mat* buffer : { &image_, &mean_, &mean_sq_, &a_, &b_, &columns_, &sums_,
+                             &grid_, &grid_scratch_ }) {
+        buffer->allocator = allocator;
+    }
+}
+
+void SpatialDenoiser::guidedFilter(const cv::Mat& src, cv::Mat& dst, int radius, float eps) {
+    CV_Assert(src.type() == CV_8UC3 || src.type() == CV_16UC3);
+    if (src.depth() == CV_8U) {
+        guidedFilterAs<uchar>(src, dst, std::max(radius, 0), eps);
+    } else {
+        guidedFilterAs<ushort>(src, dst, std::max(radius, 0), eps * 257.0f * 257.0f);
+    }
+}
+
+// Every step writes into a kept plane, and the per-pixel steps are fused
+// into row loops, so a steady stream of frames does not allocate
+template <typename T>
+void SpatialDenoiser::guidedFilterAs(const cv::Mat& src, cv::Mat& dst, int radius, float eps) {
+    const int rows = src.rows;
+    const int n = src.cols * 3;
+    for (cv::Mat* plane : { &image_, &mean_, &mean_sq_, &a_, &b_ }) {
+        plane->create(src.size(), CV_32FC3);
+    }
+
+    parallelFor(cv::Range(0, rows), [&](const cv::Range& range) {
+        for (int y = range.start; y < range.end; ++y) {
+            const T* in = src.ptr<T>(y);
+            float* image = image_.ptr<float>(y);
+            float* square = a_.ptr<float>(y);
+            for (int x = 0; x < n; ++x) {
+                image[x] = in[x];
+                square[x] = image[x] * image[x];
+            }
+        }
+    });
+    boxMean(image_, mean_, radius);
+    boxMean(a_, mean_sq_, radius);
+
+    // Per window: output = a * input + b, a = var / (var + eps)
+    parallelFor(cv::Range(0, rows), [&](const cv::Range& range) {
+        for (int y = range.start; y < range.end; ++y) {
+            const float* mean = mean_.ptr<float>(y);
+            const float* mean_sq = mean_sq_.ptr<float>(y);
+            float* a = a_.ptr<float>(y);
+            float* b = b_.ptr<float>(y);
+            for (int x = 0; x < n; ++x) {
+                const float var = mean_sq[x] - mean[x] * mean[x];
+                a[x] = var / (var + eps);
+                b[x] = mean[x] - a[x] * mean[x];
+            }
+        }
+    });
+
+    // Window averages of a and b; the two means are no longer needed
+    boxMean(a_, mean_sq_, radius);
+    boxMean(b_, mean_, radius);
+
+    dst.create(src.size(), src.type());
+    parallelFor(cv::Range(0, rows), [&](const cv::Range& range) {
+        for (int y = range.start; y < range.end; ++y) {
+            const float* image = image_.ptr<float>(y);
+            const float* a = mean_sq_.ptr<float>(y);
+            const float* b = mean_.ptr<float>(y);
+            T* out = dst.ptr<T>(y);
+            for (int x = 0; x < n; ++x) {
+                out[x] = cv::saturate_cast<T>(a[x] * image[x] + b[x]);
+            }
+        }
+    });
+}
+
+// Separable running sums in double, as cv::boxFilter keeps them for float:
+// each stripe slides its own column sums down its rows, then each row
+// slides a sum across. The cost per pixel does not depend on the radius.
+void SpatialDenoiser::boxMean(const cv::Mat& src, cv::Mat& dst, int radius) {
+    const int rows = src.rows;
+    const int cols = src.cols;
+    const int n = cols * 3;
+    const int stripes = rowStripes(rows);
+    columns_.create(src.size(), CV_32FC3);
+    sums_.create(stripes, n, CV_64F);
+    dst.create(src.size(), CV_32FC3);
+
+    parallelFor(cv::Range(0, stripes), [&](const cv::Range& range) {
+        for (int stripe = range.start; stripe < range.end; ++stripe) {
+            double* sum = sums_.ptr<double>(stripe);
+            const int y_begin = rows * stripe / stripes;
+            const int y_end = rows * (stripe + 1) / stripes;
+
+            std::fill(sum, sum + n, 0.0);
+            for (int k = -radius; k <= radius; ++k) {
+                const float* line = src.ptr<float>(mirrorIndex(y_begin + k, rows));
+                for (int x = 0; x < n; ++x) {
+                    sum[x] += line[x];
+                }
+            }
+            for (int y = y_begin; y < y_end; ++y) {
+                float* out = columns_.ptr<float>(y);
+                for (int x = 0; x < n; ++x) {
+                    out[x] = static_cast<float>(sum[x]);
+                }
+                if (y + 1 == y_end) {
+                    break;
+                }
+                const float* enter = src.ptr<float>(mirrorIndex(y + 1 + radius, rows));
+                const float* leave = src.ptr<float>(mirrorIndex(y - radius, rows));
+                for (int x = 0; x < n; ++x) {
+                    sum[x] += enter[x] - leave[x];
+                }
+            }
+        }
+    }, stripes);
+
+    const double scale = 1.0 / ((2.0 * radius + 1.0) * (2.0 * radius + 1.0));
+    parallelFor(cv::Range(0, rows), [&](const cv::Range& range) {
+        for (int y = range.start; y < range.end; ++y) {
+            const float* in = columns_.ptr<float>(y);
+            float* out = dst.ptr<float>(y);
+            for (int c = 0; c < 3; ++c) {
+                double sum = 0.0;
+                for (int k = -radius; k <= radius; ++k) {
+                    sum += in[mirrorIndex(k, cols) * 3 + c];
+                }
+                for (int x = 0; x < cols; ++x) {
+                    out[x * 3 + c] = static_cast<float>(sum * scale);
+                    sum += in[mirrorIndex(x + 1 + radius, cols) * 3 + c] -
+                           in[mirrorIndex(x - radius, cols) * 3 + c];
+                }
+            }
+        }
+    });
+}
+
+void SpatialDenoiser::bilateralGrid(const cv::Mat& src, cv::Mat& dst, int cell, int range,
+                                   int frame_row) {
+    CV_Assert(src.type() == CV_8UC3 || src.type() == CV_16UC3);
+    if (src.depth() == CV_8U) {
+        bilateralGridAs<uchar>(src, dst, cell, range, frame_row);
+    } else {
+        bilateralGridAs<ushort>(src, dst, cell, range, frame_row);
+    }
+}
+
+template <typename T>
+void SpatialDenoiser::bilateralGridAs(const cv::Mat& src, cv::Mat& dst, int cell, int range,
+                                      int frame_row) {
+    cell = std::max(cell, 1);
+    range = std::max(range, 1);
+
+    // One spare cell per axis for nearest-cell rounding and one for the
+    // upper trilinear neighbour
+    const int offset = frame_row % cell;
+    const int width = (src.cols + cell - 1) / cell + 2;
+    const int height = (src.rows + offset + cell - 1) / cell + 2;
+    const int depth = 255 / range + 3;
+    grid_.create(height * width, depth, CV_32FC4);
+    grid_scratch_.create(grid_.size(), CV_32FC4);
+    cv::Vec4f* grid = grid_.ptr<cv::Vec4f>();
+    cv::Vec4f* scratch = grid_scratch_.ptr<cv::Vec4f>();
+    std::fill(grid, grid + grid_.total(), cv::Vec4f::all(0.0f));  // setTo allocates its pattern
+
+    // Splat (B, G, R, 1) into the nearest cell. Each grid row owns the
+    // pixel rows that round to it, so rows splat in parallel.
+    parallelFor(cv::Range(0, height), [&](const cv::Range& rows) {
+        for (int gy = rows.start; gy < rows.end; ++gy) {
+            const int first = gy * cell - cell / 2 - offset;
+            const int y_begin = std::max(0, first);
+            const int y_end = std::min(src.rows, first + cell);
+            for (int y = y_begin; y < y_end; ++y) {
+                const T* px = src.ptr<T>(y);
+                for (int x = 0; x < src.cols; ++x, px += 3) {
+                    const int gx = (x + cell / 2) / cell;
+                    const int gz = (bgrLuma8(px) + range / 2) / range;
+                    cv::Vec4f& c = grid[(static_cast<size_t>(gy) * width + gx) * depth + gz];
+                    c += cv::Vec4f(px[0], px[1], px[2], 1.0f);
+                }
+            }
+        }
+    });
+
+    blurGridAxis(grid, scratch, width, height, depth, 0);
+    blurGridAxis(scratch, grid, width, height, depth, 1);
+    blurGridAxis(grid, scratch, width, height, depth, 2);
+
+    // Slice: trilinear read at each pixel's own position and luma
+    dst.create(src.size(), src.type());
+    const float inv_cell = 1.0f / cell;
+    const float inv_range = 1.0f / range;
+    parallelFor(cv::Range(0, src.rows), [&](const cv::Range& rows) {
+        for (int y = rows.start; y < rows.end; ++y) {
+            const T* px = src.ptr<T>(y);
+            T* out = dst.ptr<T>(y);
+            const float fy = (y + offset) * inv_cell;
+            const int iy = static_cast<int>(fy);
+            const float ty = fy - iy;
+
+            for (int x = 0; x < src.cols; ++x, px += 3, out += 3) {
+                const float fx = x * inv_cell;
+                const int ix = static_cast<int>(fx);
+                const float tx = fx - ix;
+                const float fz = bgrLuma8(px) * inv_range;
+                const int iz = static_cast<int>(fz);
+                const float tz = fz - iz;
+
+                cv::Vec4f sum = cv::Vec4f::all(0.0f);
+                for (int dy = 0; dy < 2; ++dy) {
+                    const float wy = dy ? ty : 1.0f - ty;
+                    for (int dx = 0; dx < 2; ++dx) {
+                        const float wxy = wy * (dx ? tx : 1.0f - tx);
+                        const cv::Vec4f* c = &scratch[
+                            (static_cast<size_t>(iy + dy) * width + ix + dx) * depth + iz];
+                        sum += c[0] * (wxy * (1.0f - tz)) + c[1] * (wxy * tz);
+                    }
+                }
+
+                if (sum[3] > 1e-6f) {
+                    const float inv_weight = 1.0f / sum[3];
+                    out[0] = cv::saturate_cast<T>(sum[0] * inv_weight);
+                    out[1] = cv::saturate_cast<T>(sum[1] * inv_weight);
+                    out[2] = cv::saturate_cast<T>(sum[2] * inv_weight);
+                } else {
+                    out[0] = px[0];
+                    out[1] = px[1];
+                    out[2] = px[2];
+                }
+            }
+        }
+    });
+}
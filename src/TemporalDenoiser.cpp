@@ -0,0 +1,151 @@
+#include "TemporalDenoiser.h"
+#include "ParallelFor.h"
+#include <algorithm>
+#include <cstdlib>
+
+void TemporalDenoiser::setAllocator(cv::MatAllocator* allocator) {
+    history_[0].allocator = allocator;
+    history_[1].allocator = allocator;
+}
+
+void TemporalDenoiser::beginFrame(cv::Size size, const Settings& settings) {
+    if (size != size_) {
+        size_ = size;
+        history_[0].create(size, CV_16UC3);
+        history_[1].create(size, CV_16UC3);
+        has_history_ = false;
+    }
+    settings_ = settings;
+
+    // Differences under the threshold (summed over B, G and R) are taken as
+    // noise and get the minimum weight; from three times it, as motion
+    const float strength = std::max(settings.strength, 0.0f);
+    const float min_weight = 1.0f / (1.0f + 2.0f * strength);
+    const float threshold = 6.0f + 9.0f * strength;
+    for (int d = 0; d < 766; ++d) {
+        float t = (d - threshold) / (2.0f * threshold);
+        t = std::min(std::max(t, 0.0f), 1.0f);
+        weight_lut_[d] = static_cast<uint16_t>(cvRound((min_weight + (1.0f - min_weight) * t) * 256.0f));
+    }
+}
+
+namespace {
+
+// Samples of T scaled to the 16-bit history: 8-bit ones up by 8 bits,
+// 16-bit ones as they are. Differences are measured in 8-bit levels.
+template <typename T> struct HistoryScale;
+template <> struct HistoryScale<uchar> {
+    static int toHistory(int v) { return v << 8; }
+    static int toLevel(int v) { return v; }
+    static uchar fromHistory(int v) { return static_cast<uchar>((v + 128) >> 8); }
+};
+template <> struct HistoryScale<uint16_t> {
+    static int toHistory(int v) { return v; }
+    static int toLevel(int v) { return (v + 128) >> 8; }
+    static uint16_t fromHistory(int v) { return static_cast<uint16_t>(v); }
+};
+
+// 3x3 mean with replicated edges, as cv::blur with BORDER_REPLICATE but
+// without the scratch rows it allocates on every call
+template <typename T>
+void boxFilter3x3(const cv::Mat& src, cv::Mat& dst) {
+    const int rows = src.rows;
+    const int cols = src.cols;
+    parallelFor(cv::Range(0, rows), [&](const cv::Range& range) {
+        for (int y = range.start; y < range.end; ++y) {
+            const T* above = src.ptr<T>(std::max(y - 1, 0));
+            const T* row = src.ptr<T>(y);
+            const T* below = src.ptr<T>(std::min(y + 1, rows - 1));
+            T* out = dst.ptr<T>(y);
+            for (int x = 0; x < cols; ++x) {
+                const int left = std::max(x - 1, 0) * 3;
+                const int mid = x * 3;
+                const int right = std::min(x + 1, cols - 1) * 3;
+                for (int c = 0; c < 3; ++c) {
+                    const int sum = above[left + c] + above[mid + c] + above[right + c] +
+                                    row[left + c] + row[mid + c] + row[right + c] +
+                                    below[left + c] + below[mid + c] + below[right + c];
+                    out[mid + c] = static_cast<T>((sum + 4) / 9);
+                }
+            }
+        }
+    });
+}
+
+} // namespace
+
+void TemporalDenoiser::filterRows(cv::Mat& rows, int frame_row,
+                                  int update_begin, int update_end, cv::Mat& prefiltered) {
+    CV_Assert((rows.type() == CV_8UC3 || rows.type() == CV_16UC3) &&
+              rows.cols == size_.width && frame_row + rows.rows <= size_.height);
+    if (rows.depth() == CV_8U) {
+        filterRowsAs<uchar>(rows, frame_row, update_begin, update_end, prefiltered);
+    } else {
+        filterRowsAs<uint16_t>(rows, frame_row, update_begin, update_end, prefiltered);
+    }
+}
+
+template <typename T>
+void TemporalDenoiser::filterRowsAs(cv::Mat& rows, int frame_row,
+                                    int update_begin, int update_end, cv::Mat& prefiltered) {
+    using Scale = HistoryScale<T>;
+    cv::Mat& next = history_[1 - read_];
+    const int n = rows.cols * 3;
+
+    // The first frame passes through and seeds the history
+    if (!has_history_) {
+        for (int y = update_begin; y < update_end; ++y) {
+            const T* px = rows.ptr<T>(y);
+            uint16_t* hist = next.ptr<uint16_t>(frame_row + y);
+            for (int x = 0; x < n; ++x) {
+                hist[x] = static_cast<uint16_t>(Scale::toHistory(px[x]));
+            }
+        }
+        return;
+    }
+
+    const cv::Mat* detect_rows = &rows;
+    if (settings_.spatial_prefilter) {
+        prefiltered.create(rows.size(), rows.type());
+        boxFilter3x3<T>(rows, prefiltered);
+        detect_rows = &prefiltered;
+    }
+    const cv::Mat& detect = *detect_rows;
+
+    const cv::Mat& prev = history_[read_];
+    parallelFor(cv::Range(0, rows.rows), [&](const cv::Range& range) {
+        for (int y = range.start; y < range.end; ++y) {
+            T* px = rows.ptr<T>(y);
+            const T* dx = detect.ptr<T>(y);
+            const uint16_t* hist = prev.ptr<uint16_t>(frame_row + y);
+            uint16_t* out = (y >= update_begin && y < update_end)
+                          ? next.ptr<uint16_t>(frame_row + y) : nullptr;
+
+            for (int x = 0; x < n; x += 3) {
+                int diff = 0;
+                for (int c = 0; c < 3; ++c) {
+                    diff += std::abs(Scale::toLevel(dx[x + c]) - ((hist[x + c] + 128) >> 8));
+                }
+                const int weight = weight_lut_[std::min(diff, 765)];
+
+                for (int c = 0; c < 3; ++c) {
+                    const int h = hist[x + c];
+                    const int v = h + ((weight * (Scale::toHistory(px[x + c]) - h)) >> 8);
+                    if (out) {
+                        out[x + c] = static_cast<uint16_t>(v);
+                    }
+                    px[x + c] = Scale::fromHistory(v);
+                }
+            }
+        }
+    });
+}
+
+void TemporalDenoiser::endFrame() {
+    read_ = 1 - read_;
+    has_history_ = true;
+}
+
+void TemporalDenoiser::reset() {
+    has_history_ = false;
+}
@@ -0,0 +1,72 @@
+#include "UndistortMapCache.h"
+#include <opencv2/calib3d.hpp>
+#include <opencv2/imgproc.hpp>
+
+namespace {
+
+bool sameContents(const cv::Mat& a, const cv::Mat& b) {
+    if (a.size() != b.size() || a.type() != b.type()) {
+        return false;
+    }
+    return a.empty() || cv::norm(a, b, cv::NORM_INF) == 0.0;
+}
+
+} // namespace
+
+bool UndistortMapCache::matches(const cv::Mat& camera_matrix, 
+                                const cv::Mat& distortion_coeffs,
+                                cv::Size size, double alpha) const {
+    return !map_xy_.empty() && size == size_ && alpha == alpha_ &&
+           sameContents(camera_matrix, camera_matrix_) &&
+           sameContents(distortion_coeffs, distortion_coeffs_);
+}
+
+void UndistortMapCache::update(const cv::Mat& camera_matrix, 
+                               const cv::Mat& distortion_coeffs,
+                               cv::Size size, double alpha) {
+    if (matches(camera_matrix, distortion_coeffs, size, alpha)) {
+        return;
+    }
+    
+    camera_matrix_ = camera_matrix.clone();
+    distortion_coeffs_ = distortion_coeffs.clone();
+    size_ = size;
+    alpha_ = alpha;
+    
+    new_camera_matrix_ = alpha < 0.0 
+        ? camera_matrix_ 
+        : cv::getOptimalNewCameraMatrix(camera_matrix_, distortion_coeffs_, 
+                                        size_, alpha, size_);
+    cv::initUndistortRectifyMap(camera_matrix_, distortion_coeffs_, cv::Mat(),
+                                new_camera_matrix_, size_, CV_16SC2,
+                                map_xy_, map_interp_);
+}
+
+void UndistortMapCache::undistort(const cv::Mat& src, cv::Mat& dst,
+                                  const cv::Mat& camera_matrix, 
+                                  const cv::Mat& distortion_coeffs,
+                                  double alpha) {
+    if (src.empty() || camera_matrix.empty()) {
+        src.copyTo(dst);
+        return;
+    }
+    
+    update(camera_matrix, distortion_coeffs, src.size(), alpha);
+    
+    // remap splits the frame across cores itself
+    cv::remap(src, dst, map_xy_, map_interp_, cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+}
+
+void UndistortMapCache::remapRows(const cv::Mat& src, cv::Mat& dst, 
+                                  int row_begin, int row_end) const {
+    CV_Assert(src.size() == size_ && !map_xy_.empty());
+    cv::remap(src, dst, map_xy_.rowRange(row_begin, row_end), 
+              map_interp_.rowRange(row_begin, row_end),
+              cv::INTER_LINEAR, cv::BORDER_CONSTANT);
+}
+
+void UndistortMapCache::invalidate() {
+    map_xy_.release();
+    map_interp_.release();
+    new_camera_matrix_.release();
+}
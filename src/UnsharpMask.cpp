@@ -0,0 +1,153 @@
+#include "UnsharpMask.h"
+#include "ImageKernels.h"
+#include "ParallelFor.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const int kMaxRadius = 8;
+const int kWeightBits = 14;
+
+inline int clampRadius(int radius) {
+    return std::min(std::max(radius, 1), kMaxRadius);
+}
+
+// Gaussian taps in Q14, at the sigma OpenCV takes for a kernel of this size;
+// the rounding residue goes to the centre so the taps sum to exactly one
+void gaussianTaps(int radius, int taps[2 * kMaxRadius + 1]) {
+    const double sigma = 0.3 * (radius - 1) + 0.8;
+    double weights[2 * kMaxRadius + 1];
+    double total = 0.0;
+    for (int k = -radius; k <= radius; ++k) {
+        weights[k + radius] = std::exp(-k * k / (2.0 * sigma * sigma));
+        total += weights[k + radius];
+    }
+    int sum = 0;
+    for (int k = 0; k <= 2 * radius; ++k) {
+        taps[k] = static_cast<int>(std::lround(weights[k] / total * (1 << kWeightBits)));
+        sum += taps[k];
+    }
+    taps[radius] += (1 << kWeightBits) - sum;
+}
+
+template <typename T>
+void sharpenRow(T* px, const int* y_row, const int* blur, int width,
+                int amount, int threshold) {
+    for (int x = 0; x < width; ++x, px += 3) {
+        int detail = y_row[x] - blur[x];
+        if (detail > threshold) {
+            detail -= threshold;
+        } else if (detail < -threshold) {
+            detail += threshold;
+        } else {
+            continue;
+        }
+        const int delta = (amount * detail + 128) >> 8;
+        px[0] = cv::saturate_cast<T>(px[0] + delta);
+        px[1] = cv::saturate_cast<T>(px[1] + delta);
+        px[2] = cv::saturate_cast<T>(px[2] + delta);
+    }
+}
+
+} // namespace
+
+void UnsharpMask::setAllocator(cv::MatAllocator* allocator) {
+    luma_.allocator = allocator;
+    rows_.allocator = allocator;
+}
+
+int UnsharpMask::halo(int radius) {
+    return clampRadius(radius);
+}
+
+void UnsharpMask::apply(cv::Mat& bgr, const Settings& settings) {
+    if (bgr.empty() || settings.amount <= 0.0f) {
+        return;
+    }
+    CV_Assert(bgr.type() == CV_8UC3 || bgr.type() == CV_16UC3);
+
+    const int radius = clampRadius(settings.radius);
+    const int taps_count = 2 * radius + 1;
+    int taps[2 * kMaxRadius + 1];
+    gaussianTaps(radius, taps);
+
+    // Amount in Q8; the threshold in the samples' units
+    const bool wide = bgr.depth() == CV_16U;
+    const int amount = cvRound(settings.amount * 256.0f);
+    const int threshold = cvRound(std::max(settings.threshold, 0.0f) * (wide ? 257.0f : 1.0f));
+
+    const int rows = bgr.rows;
+    const int cols = bgr.cols;
+    luma_.create(rows, cols, CV_32SC1);
+    parallelFor(cv::Range(0, rows), [&](const cv::Range& range) {
+        for (int y = range.start; y < range.end; ++y) {
+            int* out = luma_.ptr<int>(y);
+            if (wide) {
+                const ushort* px = bgr.ptr<ushort>(y);
+                for (int x = 0; x < cols; ++x) out[x] = bgrLuma(px + x * 3);
+            } else {
+                const uchar* px = bgr.ptr<uchar>(y);
+                for (int x = 0; x < cols; ++x) out[x] = bgrLuma(px + x * 3);
+            }
+        }
+    });
+
+    const int stripes = rowStripes(rows);
+    rows_.create(stripes * 2, cols + 2 * radius, CV_32SC1);
+    const int round = 1 << (kWeightBits - 1);
+
+    parallelFor(cv::Range(0, stripes), [&](const cv::Range& range) {
+        for (int stripe = range.start; stripe < range.end; ++stripe) {
+            int* vertical = rows_.ptr<int>(stripe * 2);
+            int* blur = rows_.ptr<int>(stripe * 2 + 1);
+            const int y_begin = rows * stripe / stripes;
+            const int y_end = rows * (stripe + 1) / stripes;
+
+            for (int y = y_begin; y < y_end; ++y) {
+                // Vertical pass into the middle of a row padded by the radius
+                int* centre = vertical + radius;
+                const int* line = luma_.ptr<int>(reflectIndex(y - radius, rows));
+                for (int x = 0; x < cols; ++x) {
+                    centre[x] = taps[0] * line[x];
+                }
+                for (int k = 1; k < taps_count; ++k) {
+                    line = luma_.ptr<int>(reflectIndex(y + k - radius, rows));
+                    const int w = taps[k];
+                    for (int x = 0; x < cols; ++x) {
+                        centre[x] += w * line[x];
+                    }
+                }
+                for (int x = 0; x < cols; ++x) {
+                    centre[x] = (centre[x] + round) >> kWeightBits;
+                }
+                for (int j = 1; j <= radius; ++j) {
+                    centre[-j] = centre[reflectIndex(-j, cols)];
+                    centre[cols - 1 + j] = centre[reflectIndex(cols - 1 + j, cols)];
+                }
+
+                // Horizontal pass
+                for (int x = 0; x < cols; ++x) {
+                    blur[x] = taps[0] * vertical[x];
+                }
+                for (int k = 1; k < taps_count; ++k) {
+                    const int w = taps[k];
+                    for (int x = 0; x < cols; ++x) {
+                        blur[x] += w * vertical[x + k];
+                    }
+                }
+                for (int x = 0; x < cols; ++x) {
+                    blur[x] = (blur[x] + round) >> kWeightBits;
+                }
+
+                if (wide) {
+                    sharpenRow(bgr.ptr<ushort>(y), luma_.ptr<int>(y), blur, cols,
+                               amount, threshold);
+                } else {
+                    sharpenRow(bgr.ptr<uchar>(y), luma_.ptr<int>(y), blur, cols,
+                               amount, threshold);
+                }
+            }
+        }
+    }, stripes);
+}